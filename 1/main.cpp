@@ -1,114 +1,2016 @@
 #include <QApplication>
 #include <QWidget>
 #include <QPainter>
-#include <QTimer>
 #include <QSlider>
 #include <QVBoxLayout>
 #include <QHBoxLayout>
 #include <cmath>
-#include <QPainterPath>
+#include <QPolygonF>
+#include <QVarLengthArray>
+#include <vector>
+#include <map>
+#include <memory>
+#include <algorithm>
+#include <random>
+#include <unordered_map>
+#include <limits>
+#include <QImage>
+#include <QKeyEvent>
+#include <QMouseEvent>
+#include <QPixmap>
+#include <QWindow>
+#include <QElapsedTimer>
+#include <QCommandLineParser>
+#include <QDir>
+#include <QFile>
+#include <QThreadPool>
+#include <QtConcurrent>
+#include <QJsonObject>
+#include <QJsonDocument>
+#include <QTextStream>
+#include <QDebug>
+#include <deque>
+#include <atomic>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+// * Bernstein basis B(k, n)(t) sampled at `samples` uniform t in [0; 1], both ends included:
+// * point i of a degree n curve = sum over k of weights[i * (n + 1) + k] * P_k
+struct BernsteinTable {
+    int degree;
+    int samples;
+    std::vector<double> weights;
+
+    // * built once per (degree, samples) and kept for the lifetime of the program
+    static const BernsteinTable& get(int degree, int samples) {
+        static std::map<std::pair<int, int>, std::unique_ptr<BernsteinTable>> cache;
+        std::unique_ptr<BernsteinTable>& table = cache[{degree, samples}];
+        if (!table) {
+            table.reset(new BernsteinTable{degree, samples, std::vector<double>(size_t(samples) * (degree + 1))});
+            for (int i = 0; i < samples; ++i) {
+                double t = samples > 1 ? double(i) / (samples - 1) : 0.0;
+                // * B(k, n) = (1 - t) * B(k, n - 1) + t * B(k - 1, n - 1): no pow() and no big binomials
+                double* w = &table->weights[size_t(i) * (degree + 1)];
+                w[0] = 1;
+                for (int n = 1; n <= degree; ++n) {
+                    w[n] = t * w[n - 1];
+                    for (int k = n - 1; k > 0; --k) {
+                        w[k] = (1 - t) * w[k] + t * w[k - 1];
+                    }
+                    w[0] *= 1 - t;
+                }
+            }
+        }
+        return *table;
+    }
+};
+
+// * piecewise Bezier curve: segments of one degree, neighbours share the end point
+// * (segment i = points[i * degree .. (i + 1) * degree]). Covers a single curve of any degree,
+// * chains of cubics and uniform B-splines (converted to Bezier segments once, on construction).
+// * t in [0; 1] runs over the whole path, every segment gets an equal share of it
+class BezierPath {
+public:
+    BezierPath() = default;
+
+    // * one curve of degree points.size() - 1
+    static BezierPath bezier(std::vector<QPointF> points) {
+        BezierPath path;
+        path.order = std::max(0, int(points.size()) - 1);
+        path.controlPoints = std::move(points);
+        return path;
+    }
+
+    // * 3k + 1 points; extra points at the end are ignored
+    static BezierPath cubicChain(std::vector<QPointF> points) {
+        BezierPath path;
+        path.order = 3;
+        points.resize(points.size() < 4 ? 0 : (points.size() - 1) / 3 * 3 + 1);
+        path.controlPoints = std::move(points);
+        return path;
+    }
+
+    // * uniform B-spline with knots 0, 1, 2, ...: points.size() - degree segments.
+    // * Bezier points of segment [i; i + 1] are blossom values f(i, ..., i, i + 1, ..., i + 1) (de Boor)
+    static BezierPath uniformBSpline(const std::vector<QPointF>& points, int degree) {
+        BezierPath path;
+        path.order = degree;
+        int last = int(points.size()) - 1;
+        if (degree < 1 || last < degree) {
+            return path;
+        }
+
+        QVarLengthArray<QPointF, 16> d(degree + 1);
+        for (int i = degree; i <= last; ++i) {
+            for (int j = i == degree ? 0 : 1; j <= degree; ++j) {
+                // * d[k] starts as P(i - degree + k); blossom argument r is i for r <= degree - j, else i + 1
+                for (int k = 0; k <= degree; ++k) {
+                    d[k] = points[i - degree + k];
+                }
+                for (int r = 1; r <= degree; ++r) {
+                    double x = r <= degree - j ? i : i + 1;
+                    for (int k = degree; k >= r; --k) {
+                        double alpha = (x - (i - degree + k)) / (degree + 1 - r);
+                        d[k] = (1 - alpha) * d[k - 1] + alpha * d[k];
+                    }
+                }
+                path.controlPoints.push_back(d[degree]);
+            }
+        }
+        return path;
+    }
+
+    int degree() const {
+        return order;
+    }
+
+    int segmentCount() const {
+        return order > 0 ? (int(controlPoints.size()) - 1) / order : 0;
+    }
+
+    const std::vector<QPointF>& points() const {
+        return controlPoints;
+    }
+
+    const QPointF* segment(int i) const {
+        return &controlPoints[size_t(i) * order];
+    }
+
+    // * moves one control point; a join point moves the ends of both its segments
+    void setPoint(int index, const QPointF& point) {
+        controlPoints[index] = point;
+    }
+
+    // * the one or two segments control point `index` belongs to: [first; last]
+    void segmentsOf(int index, int& first, int& last) const {
+        last = std::min(index / std::max(order, 1), segmentCount() - 1);
+        first = (order > 0 && index % order == 0 && index > 0) ? index / order - 1 : last;
+    }
+
+    // * De Casteljau: numerically stable for any degree
+    QPointF point(double t) const {
+        int index;
+        double local = locate(t, index);
+        return deCasteljau(segment(index), order, local);
+    }
+
+    // * dP/dt for the path parameter (hence the segmentCount() factor)
+    QPointF derivative(double t) const {
+        int index;
+        double local = locate(t, index);
+        return segmentDerivative(index, local);
+    }
+
+    // * the same on segment `index` at its own parameter u: u = 1 is the left limit at the next joint
+    QPointF segmentDerivative(int index, double u) const {
+        const QPointF* p = segment(index);
+        QVarLengthArray<QPointF, 16> hodograph(order);
+        for (int k = 0; k < order; ++k) {
+            hodograph[k] = order * segmentCount() * (p[k + 1] - p[k]);
+        }
+        return deCasteljau(hodograph.data(), order - 1, u);
+    }
+
+    // * fast path for a fixed sample count: samplesPerSegment points per segment (joints are not repeated)
+    // * through the cached Bernstein table, i.e. one dot product per coordinate per point.
+    // * Point j of the result is at path t = j / (out.size() - 1)
+    void sample(int samplesPerSegment, std::vector<QPointF>& out) const {
+        out.clear();
+        if (segmentCount() == 0 || samplesPerSegment < 2) {
+            return;
+        }
+        out.reserve(size_t(segmentCount()) * (samplesPerSegment - 1) + 1);
+        for (int s = 0; s < segmentCount(); ++s) {
+            sampleSegment(s, samplesPerSegment, out, s == 0);
+        }
+    }
+
+    // * appends `samples` uniform points of segment `index` (its first one only withFirst)
+    template <class Points>
+    void sampleSegment(int index, int samples, Points& out, bool withFirst = true) const {
+        sampleControls(segment(index), order, samples, out, withFirst);
+    }
+
+    // * the same for any degree n control polygon p[0..n], e.g. a piece split off a segment
+    template <class Points>
+    static void sampleControls(const QPointF* p, int degree, int samples, Points& out, bool withFirst = true) {
+        const BernsteinTable& table = BernsteinTable::get(degree, samples);
+        for (int i = withFirst ? 0 : 1; i < samples; ++i) {
+            const double* w = &table.weights[size_t(i) * (degree + 1)];
+            double x = 0, y = 0;
+            for (int k = 0; k <= degree; ++k) {
+                x += w[k] * p[k].x();
+                y += w[k] * p[k].y();
+            }
+            out.push_back(QPointF(x, y));
+        }
+    }
+
+    static QPointF deCasteljau(const QPointF* p, int degree, double t) {
+        if (degree < 0) {
+            return QPointF();
+        }
+        QVarLengthArray<QPointF, 16> work(p, p + degree + 1);
+        for (int level = degree; level > 0; --level) {
+            for (int k = 0; k < level; ++k) {
+                work[k] = (1 - t) * work[k] + t * work[k + 1];
+            }
+        }
+        return work[0];
+    }
+
+private:
+    int order = 0;
+    std::vector<QPointF> controlPoints;
+
+    // * path t -> (segment, local t)
+    double locate(double t, int& index) const {
+        double scaled = std::min(std::max(t, 0.0), 1.0) * segmentCount();
+        index = std::min(int(scaled), segmentCount() - 1);
+        return scaled - index;
+    }
+};
+
+// * arc length s(t) of a path, tabulated once: s at t_i = i / count plus the speed |dP/dt| at both ends
+// * of every interval. Intervals are integrated by adaptive Gauss-Legendre; inside an interval s(t)
+// * is taken as the cubic Hermite through those values, so the inverse (distance -> t) is a binary
+// * search plus a few Newton steps on that cubic and never evaluates the curve again
+class ArcLengthTable {
+public:
+    ArcLengthTable() = default;
+
+    // * intervals never straddle a joint, so a corner between segments only breaks the Hermite
+    // * fit at interval ends, where both one-sided speeds are stored
+    ArcLengthTable(const BezierPath& path, int intervalsPerSegment = 32, double tolerance = 1e-9)
+        : count(std::max(1, intervalsPerSegment * path.segmentCount())) {
+        auto speed = [&](double t) {
+            QPointF d = path.derivative(t);
+            return std::hypot(d.x(), d.y());
+        };
+
+        lengths.assign(count + 1, 0.0);
+        startSpeeds.resize(count);
+        endSpeeds.resize(count);
+        for (int i = 0; i < count; ++i) {
+            double a = double(i) / count;
+            double b = double(i + 1) / count;
+            startSpeeds[i] = speed(a);
+            // * left limit at a joint: the interval's own segment at its local end, whatever b rounds to
+            QPointF end = path.segmentDerivative(i / intervalsPerSegment, double(i % intervalsPerSegment + 1) / intervalsPerSegment);
+            endSpeeds[i] = std::hypot(end.x(), end.y());
+            lengths[i + 1] = lengths[i] + integrate(speed, a, b, gaussLegendre(speed, a, b), tolerance, 0);
+        }
+    }
+
+    double length() const {
+        return lengths.empty() ? 0.0 : lengths.back();
+    }
+
+    double parameterAt(double distance) const {
+        if (lengths.size() < 2) {
+            return 0.0;
+        }
+        distance = std::min(std::max(distance, 0.0), length());
+        int i = int(std::upper_bound(lengths.begin(), lengths.end(), distance) - lengths.begin()) - 1;
+        i = std::min(std::max(i, 0), count - 1);
+
+        // * s(u), u in [0; 1] across the interval: Hermite basis with tangents scaled by the interval width
+        double h = 1.0 / count;
+        double s0 = lengths[i], s1 = lengths[i + 1];
+        double m0 = startSpeeds[i] * h, m1 = endSpeeds[i] * h;
+        double u = s1 > s0 ? (distance - s0) / (s1 - s0) : 0.0;
+        for (int iteration = 0; iteration < 3; ++iteration) {
+            double u2 = u * u, u3 = u2 * u;
+            double s = (2 * u3 - 3 * u2 + 1) * s0 + (u3 - 2 * u2 + u) * m0 + (-2 * u3 + 3 * u2) * s1 + (u3 - u2) * m1;
+            double ds = (6 * u2 - 6 * u) * s0 + (3 * u2 - 4 * u + 1) * m0 + (-6 * u2 + 6 * u) * s1 + (3 * u2 - 2 * u) * m1;
+            if (ds <= 0) {
+                break; // * cusp (zero speed): keep the estimate
+            }
+            u = std::min(std::max(u - (s - distance) / ds, 0.0), 1.0);
+        }
+        return (i + u) * h;
+    }
+
+private:
+    int count = 0;
+    std::vector<double> lengths; // * cumulative, count + 1 entries
+    std::vector<double> startSpeeds;
+    std::vector<double> endSpeeds;
+
+    // * 5-point Gauss-Legendre on [a; b]
+    template <class F>
+    static double gaussLegendre(const F& f, double a, double b) {
+        static const double nodes[5] = {0.0, -0.5384693101056831, 0.5384693101056831, -0.9061798459386640, 0.9061798459386640};
+        static const double weights[5] = {0.5688888888888889, 0.4786286704993665, 0.4786286704993665, 0.2369268850561891, 0.2369268850561891};
+        double half = (b - a) / 2, middle = (a + b) / 2, sum = 0;
+        for (int i = 0; i < 5; ++i) {
+            sum += weights[i] * f(middle + half * nodes[i]);
+        }
+        return sum * half;
+    }
+
+    // * split in halves until the halves agree with the whole
+    template <class F>
+    static double integrate(const F& f, double a, double b, double whole, double tolerance, int depth) {
+        double middle = (a + b) / 2;
+        double left = gaussLegendre(f, a, middle);
+        double right = gaussLegendre(f, middle, b);
+        if (depth >= 16 || std::abs(left + right - whole) <= tolerance) {
+            return left + right;
+        }
+        return integrate(f, a, middle, left, tolerance / 2, depth + 1) + integrate(f, middle, b, right, tolerance / 2, depth + 1);
+    }
+};
+
+// * curves flattened into polylines once and kept until the curve or the scale changes, so painting
+// * a static curve is a single drawPolyline instead of Qt re-flattening a QPainterPath every frame.
+// * Every segment is flattened separately: moving a control point re-flattens only its segments
+class CurveCache {
+public:
+    // * tolerance - max distance between the curve and its polyline, in device pixels
+    explicit CurveCache(double tolerance = 0.25) : tolerance(tolerance) {}
+
+    int add(const BezierPath& path) {
+        entries.push_back(Entry());
+        setCurve(int(entries.size()) - 1, path);
+        return int(entries.size()) - 1;
+    }
+
+    void setCurve(int id, const BezierPath& path) {
+        Entry& entry = entries[id];
+        entry.path = path;
+        entry.segmentDirty.assign(path.segmentCount(), true);
+        entry.assembled = false;
+        entry.dirty = true;
+    }
+
+    void setControlPoint(int id, int index, const QPointF& point) {
+        Entry& entry = entries[id];
+        entry.path.setPoint(index, point);
+        int first, last;
+        entry.path.segmentsOf(index, first, last);
+        for (int i = first; i <= last; ++i) {
+            entry.segmentDirty[i] = true;
+        }
+        entry.dirty = true;
+    }
+
+    const BezierPath& curve(int id) const {
+        return entries[id].path;
+    }
+
+    int size() const {
+        return int(entries.size());
+    }
+
+    // * device pixels per curve unit (zoom, device pixel ratio); changing it re-flattens everything
+    void setScale(double value) {
+        if (value == scale) {
+            return;
+        }
+        scale = value;
+        for (Entry& entry : entries) {
+            entry.segmentDirty.assign(entry.segmentDirty.size(), true);
+            entry.assembled = false;
+            entry.dirty = true;
+        }
+    }
+
+    const QPolygonF& polyline(int id) {
+        Entry& entry = entries[id];
+        if (!entry.dirty) {
+            return entry.polyline;
+        }
+        const int count = entry.path.segmentCount();
+        if (!entry.assembled) {
+            entry.polyline.clear();
+            entry.offsets.resize(count);
+            if (count > 0) {
+                entry.polyline.append(entry.path.points().front());
+            }
+            for (int i = 0; i < count; ++i) {
+                entry.offsets[i] = entry.polyline.size();
+                flattenSegment(entry.path, i, tolerance / scale, entry.polyline);
+            }
+            entry.assembled = true;
+        } else {
+            // * splice the re-flattened segments in, the rest of the polyline stays as it is
+            if (count > 0) {
+                entry.polyline[0] = entry.path.points().front();
+            }
+            for (int i = 0; i < count; ++i) {
+                if (!entry.segmentDirty[i]) {
+                    continue;
+                }
+                QPolygonF fresh;
+                flattenSegment(entry.path, i, tolerance / scale, fresh);
+                int begin = entry.offsets[i];
+                int end = i + 1 < count ? entry.offsets[i + 1] : entry.polyline.size();
+                int delta = fresh.size() - (end - begin);
+                if (delta > 0) {
+                    entry.polyline.insert(end, delta, QPointF());
+                } else if (delta < 0) {
+                    entry.polyline.remove(end + delta, -delta);
+                }
+                std::copy(fresh.begin(), fresh.end(), entry.polyline.begin() + begin);
+                for (int j = i + 1; delta != 0 && j < count; ++j) {
+                    entry.offsets[j] += delta;
+                }
+            }
+        }
+        entry.segmentDirty.assign(count, false);
+        entry.dirty = false;
+        return entry.polyline;
+    }
+
+    // * the stretch of polyline(id) that draws one segment, its first point included; returns the point count
+    int segmentPolyline(int id, int segment, const QPointF*& points) {
+        const QPolygonF& all = polyline(id);
+        const Entry& entry = entries[id];
+        int begin = entry.offsets[segment] - 1;
+        int end = segment + 1 < int(entry.offsets.size()) ? entry.offsets[segment + 1] : all.size();
+        points = all.constData() + begin;
+        return end - begin;
+    }
+
+    // * the whole path into `out`, no further than `tolerance` from the curve
+    static void flatten(const BezierPath& path, double tolerance, QPolygonF& out) {
+        if (path.segmentCount() == 0) {
+            return;
+        }
+        out.append(path.points().front());
+        for (int i = 0; i < path.segmentCount(); ++i) {
+            flattenSegment(path, i, tolerance, out);
+        }
+    }
+
+private:
+    struct Entry {
+        BezierPath path;
+        std::vector<char> segmentDirty;
+        QPolygonF polyline;
+        std::vector<int> offsets; // * where each segment starts in the polyline (its first point is the previous end)
+        bool assembled = false; // * polyline and offsets are complete, only dirty segments need work
+        bool dirty = true;
+    };
+    std::vector<Entry> entries;
+    double tolerance;
+    double scale = 1.0;
+
+    // * appends segment i without its first point
+    static void flattenSegment(const BezierPath& path, int i, double tolerance, QPolygonF& out) {
+        std::vector<QPointF> control(path.segment(i), path.segment(i) + path.degree() + 1);
+        flattenSegment(control, tolerance, 0, out);
+    }
+
+    // * adaptive subdivision: a segment is split in halves (De Casteljau) until every inner control
+    // * point is within `tolerance` of the chord; the curve lies in the hull, so the chord is then close enough.
+    // * A piece still bent at the depth limit is sampled uniformly through the Bernstein table instead, N
+    // * intervals are within degree * (degree - 1) / 8 * max |P[k] - 2 P[k + 1] + P[k + 2]| / N^2 of it
+    static void flattenSegment(const std::vector<QPointF>& p, double tolerance, int depth, QPolygonF& out) {
+        const QPointF& first = p.front();
+        const QPointF& last = p.back();
+        QPointF chord = last - first;
+        double chordLength = std::hypot(chord.x(), chord.y());
+        double deviation = 0;
+        for (size_t k = 1; k + 1 < p.size(); ++k) {
+            QPointF d = p[k] - first;
+            // * distance to the chord line, or to the end point for a closed segment
+            deviation = std::max(deviation, chordLength > 0 ? std::abs(d.x() * chord.y() - d.y() * chord.x()) / chordLength
+                                                            : std::hypot(d.x(), d.y()));
+        }
+        if (deviation <= tolerance) {
+            out.append(last);
+            return;
+        }
+        const int n = int(p.size()) - 1;
+        if (depth >= 16) {
+            double bend = 0;
+            for (int k = 0; k + 2 <= n; ++k) {
+                QPointF d = p[k] - 2 * p[k + 1] + p[k + 2];
+                bend = std::max(bend, std::hypot(d.x(), d.y()));
+            }
+            double intervals = std::max(1.0, std::ceil(std::sqrt(n * (n - 1) / 8.0 * bend / tolerance)));
+            BezierPath::sampleControls(p.data(), n, int(intervals) + 1, out, false);
+            return;
+        }
+
+        // * De Casteljau at 1/2: left half is the first point of every level, right half the last
+        std::vector<QPointF> left(p.size()), right(p.size());
+        std::vector<QPointF> work(p);
+        for (int level = 0; level <= n; ++level) {
+            left[level] = work[0];
+            right[n - level] = work[n - level];
+            for (int k = 0; k + level < n; ++k) {
+                work[k] = (work[k] + work[k + 1]) / 2;
+            }
+        }
+        flattenSegment(left, tolerance, depth + 1, out);
+        flattenSegment(right, tolerance, depth + 1, out);
+    }
+};
+
+// * ids bucketed by the grid cells their bounds overlap. Cells live in a hash map, so the grid has no
+// * extent to pick and empty space costs nothing; a query visits only the cells under its rectangle
+class UniformGrid {
+public:
+    explicit UniformGrid(double cellSize = 64) : cellSize(cellSize) {}
+
+    void insert(int id, const QRectF& bounds) {
+        forCells(bounds, [&](quint64 key) { cells[key].push_back(id); });
+    }
+
+    // * bounds must be the ones the id was inserted with
+    void remove(int id, const QRectF& bounds) {
+        forCells(bounds, [&](quint64 key) {
+            auto cell = cells.find(key);
+            if (cell == cells.end()) {
+                return;
+            }
+            std::vector<int>& ids = cell->second;
+            auto found = std::find(ids.begin(), ids.end(), id);
+            if (found != ids.end()) {
+                *found = ids.back();
+                ids.pop_back();
+            }
+            if (ids.empty()) {
+                cells.erase(cell);
+            }
+        });
+    }
+
+    // * every id whose cells touch rect, each once (a candidate list: the caller tests exact bounds)
+    void query(const QRectF& rect, std::vector<int>& out) const {
+        out.clear();
+        forCells(rect, [&](quint64 key) {
+            auto cell = cells.find(key);
+            if (cell != cells.end()) {
+                out.insert(out.end(), cell->second.begin(), cell->second.end());
+            }
+        });
+        std::sort(out.begin(), out.end());
+        out.erase(std::unique(out.begin(), out.end()), out.end());
+    }
+
+private:
+    template <class Visit>
+    void forCells(const QRectF& rect, Visit&& visit) const {
+        int x0 = int(std::floor(rect.left() / cellSize)), x1 = int(std::floor(rect.right() / cellSize));
+        int y0 = int(std::floor(rect.top() / cellSize)), y1 = int(std::floor(rect.bottom() / cellSize));
+        for (int y = y0; y <= y1; ++y) {
+            for (int x = x0; x <= x1; ++x) {
+                // * both halves as unsigned bits: shifting a negative x would be undefined before C++20
+                visit(quint64(quint32(x)) << 32 | quint32(y));
+            }
+        }
+    }
+
+    double cellSize;
+    std::unordered_map<quint64, std::vector<int>> cells;
+};
+
+// * picking and dragging control points of curves kept in a CurveCache. Control points and segment
+// * bounds (the box of the segment's control points, which holds the curve) sit in uniform grids,
+// * so a pick or a hit test near the mouse costs the same with ten points or with a hundred thousand,
+// * and a drag updates only the moved point, its one or two segments and their polylines
+class CurveEditor {
+public:
+    struct Handle {
+        int curve;
+        int index; // * control point or segment, depending on the query
+    };
+
+    explicit CurveEditor(CurveCache& curves, double cellSize = 64)
+        : curves(curves), pointGrid(cellSize), segmentGrid(cellSize) {}
+
+    // * makes the points of a cached curve editable
+    void addCurve(int id) {
+        if (int(firstItems.size()) <= id) {
+            firstItems.resize(id + 1, {-1, -1});
+        }
+        const BezierPath& path = curves.curve(id);
+        firstItems[id] = {int(points.size()), int(segments.size())};
+        for (int i = 0; i < int(path.points().size()); ++i) {
+            pointGrid.insert(int(points.size()), pointBounds(path.points()[i]));
+            points.push_back({id, i});
+        }
+        for (int i = 0; i < path.segmentCount(); ++i) {
+            segmentBounds.push_back(boundsOf(path, i));
+            segmentGrid.insert(int(segments.size()), segmentBounds.back());
+            segments.push_back({id, i});
+        }
+    }
+
+    // * the control point nearest to pos within radius
+    bool pick(const QPointF& pos, double radius, Handle& handle) const {
+        pointGrid.query(QRectF(pos.x() - radius, pos.y() - radius, 2 * radius, 2 * radius), candidates);
+        double best = radius * radius;
+        bool found = false;
+        for (int item : candidates) {
+            QPointF d = curves.curve(points[item].curve).points()[points[item].index] - pos;
+            double distance = d.x() * d.x() + d.y() * d.y();
+            if (distance <= best) {
+                best = distance;
+                handle = points[item];
+                found = true;
+            }
+        }
+        return found;
+    }
+
+    // * segments whose bounds intersect rect, e.g. the ones worth an exact hit test around the mouse
+    void segmentsIn(const QRectF& rect, std::vector<Handle>& out) const {
+        segmentGrid.query(rect, candidates);
+        out.clear();
+        for (int item : candidates) {
+            const QRectF& bounds = segmentBounds[item];
+            if (bounds.left() <= rect.right() && rect.left() <= bounds.right() && bounds.top() <= rect.bottom() && rect.top() <= bounds.bottom()) {
+                out.push_back(segments[item]);
+            }
+        }
+    }
+
+    // * moves a control point; returns the area the curve could have changed in (old and new segment bounds)
+    QRectF move(const Handle& handle, const QPointF& pos) {
+        const int pointItem = firstItems[handle.curve].first + handle.index;
+        pointGrid.remove(pointItem, pointBounds(curves.curve(handle.curve).points()[handle.index]));
+        curves.setControlPoint(handle.curve, handle.index, pos);
+        pointGrid.insert(pointItem, pointBounds(pos));
+
+        const BezierPath& path = curves.curve(handle.curve);
+        int first, last;
+        path.segmentsOf(handle.index, first, last);
+        QRectF changed;
+        for (int i = first; i <= last; ++i) {
+            const int segmentItem = firstItems[handle.curve].second + i;
+            changed = changed.united(segmentBounds[segmentItem]);
+            segmentGrid.remove(segmentItem, segmentBounds[segmentItem]);
+            segmentBounds[segmentItem] = boundsOf(path, i);
+            segmentGrid.insert(segmentItem, segmentBounds[segmentItem]);
+            changed = changed.united(segmentBounds[segmentItem]);
+        }
+        return changed;
+    }
+
+private:
+    static QRectF pointBounds(const QPointF& p) {
+        return QRectF(p, p);
+    }
+
+    static QRectF boundsOf(const BezierPath& path, int segment) {
+        const QPointF* p = path.segment(segment);
+        double left = p[0].x(), right = left, top = p[0].y(), bottom = top;
+        for (int k = 1; k <= path.degree(); ++k) {
+            left = std::min(left, p[k].x());
+            right = std::max(right, p[k].x());
+            top = std::min(top, p[k].y());
+            bottom = std::max(bottom, p[k].y());
+        }
+        return QRectF(QPointF(left, top), QPointF(right, bottom));
+    }
+
+    CurveCache& curves;
+    UniformGrid pointGrid, segmentGrid;
+    std::vector<Handle> points, segments; // * grid item -> curve and index
+    std::vector<QRectF> segmentBounds;
+    std::vector<std::pair<int, int>> firstItems; // * per curve id: first point item, first segment item
+    mutable std::vector<int> candidates;
+};
+
+// * closest point, line and curve-curve intersection queries on one BezierPath, built once per curve:
+// * every segment is cut into a few pieces, each bounded by the box of its control points (the curve
+// * stays inside their hull), and the pieces go into a binary bounding volume hierarchy. A query walks
+// * only the boxes that can matter, subdivides the pieces that survive until they are nearly straight
+// * and finishes with Newton iterations. t in the results is the path parameter, as in BezierPath::point()
+class CurveQueries {
+public:
+    CurveQueries() = default;
+
+    explicit CurveQueries(const BezierPath& path, int piecesPerSegment = 4) : path(path) {
+        const int n = path.degree() + 1;
+        QVarLengthArray<QPointF, 16> rest(n), left(n), right(n);
+        for (int s = 0; s < path.segmentCount(); ++s) {
+            std::copy(path.segment(s), path.segment(s) + n, rest.begin());
+            // * cut off [k / pieces; (k + 1) / pieces] one after another from what is left of the segment
+            for (int k = 0; k < piecesPerSegment; ++k) {
+                split(rest.data(), n - 1, 1.0 / (piecesPerSegment - k), left.data(), right.data());
+                pieces.push_back({s, double(k) / piecesPerSegment, double(k + 1) / piecesPerSegment, int(controls.size())});
+                controls.insert(controls.end(), left.begin(), left.end());
+                std::copy(right.begin(), right.end(), rest.begin());
+            }
+        }
+        std::vector<int> order(pieces.size());
+        for (size_t i = 0; i < order.size(); ++i) {
+            order[i] = int(i);
+        }
+        if (!order.empty()) {
+            build(order, 0, int(order.size()));
+            Box root = nodes[0].box;
+            extent = std::max(1.0, std::hypot(root.x1 - root.x0, root.y1 - root.y0));
+            epsilon = 1e-9 * extent;
+        }
+    }
+
+    const BezierPath& curve() const {
+        return path;
+    }
+
+    // * the point of the curve closest to p, its path parameter in *t
+    QPointF closestPoint(const QPointF& p, double* t = nullptr) const {
+        Closest best{std::numeric_limits<double>::infinity(), 0, QPointF()};
+        if (!nodes.empty()) {
+            closest(0, p, best);
+        }
+        if (t) {
+            *t = best.t;
+        }
+        return best.point;
+    }
+
+    // * path parameters, ascending, where the curve crosses the line through origin along direction;
+    // * with ray only the crossings in front of origin
+    std::vector<double> intersectLine(const QPointF& origin, const QPointF& direction, bool ray = false) const {
+        std::vector<double> ts;
+        Line line{origin, direction, QPointF(-direction.y(), direction.x()), ray};
+        if (!nodes.empty()) {
+            crossings(0, line, ts);
+        }
+        std::sort(ts.begin(), ts.end());
+        ts.erase(std::unique(ts.begin(), ts.end(), [](double a, double b) { return b - a < 1e-9; }), ts.end());
+        return ts;
+    }
+
+    // * a stretch both curves share: [from; to] on this one, [otherFrom; otherTo] on the other
+    // * (otherFrom > otherTo if the other curve runs the opposite way)
+    struct Overlap {
+        double from, to, otherFrom, otherTo;
+    };
+
+    // * crossings with another curve: (t on this curve, t on the other), ordered by the first.
+    // * A shared stretch is no pile of crossings: it is reported once, by its two ends in the result
+    // * and as a whole in *overlaps. The search stops after maxHits results or its work budget
+    std::vector<std::pair<double, double>> intersect(const CurveQueries& other, std::vector<Overlap>* overlaps = nullptr) const {
+        Search search;
+        if (!nodes.empty() && !other.nodes.empty()) {
+            intersectNodes(0, other, 0, search);
+        }
+        // * crossings found inside a shared stretch are that stretch, not crossings
+        auto inside = [&](const std::pair<double, double>& hit) {
+            for (const Overlap& o : search.overlaps) {
+                if (hit.first >= o.from - 1e-9 && hit.first <= o.to + 1e-9
+                    && hit.second >= std::min(o.otherFrom, o.otherTo) - 1e-9 && hit.second <= std::max(o.otherFrom, o.otherTo) + 1e-9) {
+                    return true;
+                }
+            }
+            return false;
+        };
+        std::vector<std::pair<double, double>>& hits = search.hits;
+        hits.erase(std::remove_if(hits.begin(), hits.end(), inside), hits.end());
+
+        // * the stretches come piece by piece: join the ones that continue each other on both curves
+        std::vector<Overlap>& pieceOverlaps = search.overlaps;
+        std::sort(pieceOverlaps.begin(), pieceOverlaps.end(), [](const Overlap& a, const Overlap& b) { return a.from < b.from; });
+        std::vector<Overlap> joined;
+        for (const Overlap& o : pieceOverlaps) {
+            bool continues = false;
+            for (Overlap& j : joined) {
+                if (o.from <= j.to + 1e-9 && std::abs(o.otherFrom - j.otherTo) <= 1e-9) {
+                    j.to = std::max(j.to, o.to);
+                    j.otherTo = o.otherTo;
+                    continues = true;
+                    break;
+                }
+            }
+            if (!continues) {
+                joined.push_back(o);
+            }
+        }
+        for (const Overlap& j : joined) {
+            hits.push_back({j.from, j.otherFrom});
+            hits.push_back({j.to, j.otherTo});
+        }
+        if (overlaps) {
+            *overlaps = joined;
+        }
+
+        std::sort(hits.begin(), hits.end());
+        hits.erase(std::unique(hits.begin(), hits.end(), [](const std::pair<double, double>& a, const std::pair<double, double>& b) {
+            return b.first - a.first < 1e-9 && std::abs(b.second - a.second) < 1e-9;
+        }), hits.end());
+        return hits;
+    }
+
+private:
+    struct Box {
+        double x0, y0, x1, y1;
+
+        static Box of(const QPointF* p, int count) {
+            Box box{p[0].x(), p[0].y(), p[0].x(), p[0].y()};
+            for (int k = 1; k < count; ++k) {
+                box.add(p[k]);
+            }
+            return box;
+        }
+        void add(const QPointF& p) {
+            x0 = std::min(x0, p.x()); y0 = std::min(y0, p.y());
+            x1 = std::max(x1, p.x()); y1 = std::max(y1, p.y());
+        }
+        void add(const Box& b) {
+            x0 = std::min(x0, b.x0); y0 = std::min(y0, b.y0);
+            x1 = std::max(x1, b.x1); y1 = std::max(y1, b.y1);
+        }
+        // * margin: how far apart still counts as touching (a tangent point may round off either way)
+        bool overlaps(const Box& b, double margin = 0) const {
+            return x0 <= b.x1 + margin && b.x0 <= x1 + margin && y0 <= b.y1 + margin && b.y0 <= y1 + margin;
+        }
+        double distance2(const QPointF& p) const {
+            double dx = std::max({x0 - p.x(), 0.0, p.x() - x1});
+            double dy = std::max({y0 - p.y(), 0.0, p.y() - y1});
+            return dx * dx + dy * dy;
+        }
+        double size() const {
+            return std::max(x1 - x0, y1 - y0);
+        }
+    };
+
+    struct Piece {
+        int segment;
+        double u0, u1; // * range of the segment parameter
+        int first; // * control points in `controls`
+    };
+
+    struct Node {
+        Box box;
+        int left, right; // * children, or -1 in a leaf
+        int piece; // * leaf only
+    };
+
+    struct Closest {
+        double distance2;
+        double t;
+        QPointF point;
+    };
+
+    struct Line {
+        QPointF origin, direction, normal;
+        bool ray;
+    };
+
+    int build(std::vector<int>& order, int begin, int end) {
+        int index = int(nodes.size());
+        nodes.push_back({Box(), -1, -1, -1});
+        Box box = pieceBox(order[begin]);
+        for (int i = begin + 1; i < end; ++i) {
+            box.add(pieceBox(order[i]));
+        }
+        nodes[index].box = box;
+        if (end - begin == 1) {
+            nodes[index].piece = order[begin];
+            return index;
+        }
+        // * median split along the longer side
+        bool alongX = box.x1 - box.x0 >= box.y1 - box.y0;
+        int middle = (begin + end) / 2;
+        std::nth_element(order.begin() + begin, order.begin() + middle, order.begin() + end, [&](int a, int b) {
+            Box ba = pieceBox(a), bb = pieceBox(b);
+            return alongX ? ba.x0 + ba.x1 < bb.x0 + bb.x1 : ba.y0 + ba.y1 < bb.y0 + bb.y1;
+        });
+        int left = build(order, begin, middle);
+        int right = build(order, middle, end);
+        nodes[index].left = left;
+        nodes[index].right = right;
+        return index;
+    }
+
+    Box pieceBox(int piece) const {
+        return Box::of(&controls[pieces[piece].first], path.degree() + 1);
+    }
+
+    double pathT(const Piece& piece, double u) const {
+        return (piece.segment + piece.u0 + u * (piece.u1 - piece.u0)) / path.segmentCount();
+    }
+
+    // * De Casteljau split at t: left and right get degree + 1 points each
+    static void split(const QPointF* p, int degree, double t, QPointF* left, QPointF* right) {
+        QVarLengthArray<QPointF, 16> work(p, p + degree + 1);
+        for (int level = 0; level <= degree; ++level) {
+            left[level] = work[0];
+            right[degree - level] = work[degree - level];
+            for (int k = 0; k + level < degree; ++k) {
+                work[k] = (1 - t) * work[k] + t * work[k + 1];
+            }
+        }
+    }
+
+    // * point, first and second derivative at u from the last De Casteljau levels
+    static void evaluate(const QPointF* p, int degree, double u, QPointF& point, QPointF& d1, QPointF& d2) {
+        QVarLengthArray<QPointF, 16> work(p, p + degree + 1);
+        d1 = d2 = QPointF();
+        for (int level = degree; level > 0; --level) {
+            if (level == 2) {
+                d2 = double(degree) * (degree - 1) * (work[2] - 2 * work[1] + work[0]);
+            } else if (level == 1) {
+                d1 = double(degree) * (work[1] - work[0]);
+            }
+            for (int k = 0; k < level; ++k) {
+                work[k] = (1 - u) * work[k] + u * work[k + 1];
+            }
+        }
+        point = work[0];
+    }
+
+    // * a control polygon this close to its chord and running along it (no point steps back, so the piece
+    // * cannot fold over itself) is treated as a straight piece: one root, one minimum
+    static bool isFlat(const QPointF* p, int degree) {
+        QPointF chord = p[degree] - p[0];
+        double length = std::hypot(chord.x(), chord.y());
+        double deviation = 0;
+        for (int k = 1; k < degree; ++k) {
+            QPointF d = p[k] - p[0];
+            deviation = std::max(deviation, length > 0 ? std::abs(d.x() * chord.y() - d.y() * chord.x()) / length : std::hypot(d.x(), d.y()));
+        }
+        for (int k = 0; k < degree; ++k) {
+            if (QPointF::dotProduct(p[k + 1] - p[k], chord) < 0) {
+                return false;
+            }
+        }
+        return deviation <= 0.01 * length;
+    }
+
+    static const int maxDepth = 24;
+    // * bounds of one intersect(): results, and piece pairs looked at (a couple of seconds at most)
+    static const int maxHits = 1 << 16;
+    static const int pairBudget = 1 << 22;
+
+    struct Search {
+        std::vector<std::pair<double, double>> hits;
+        std::vector<Overlap> overlaps; // * per piece pair, joined by intersect()
+        int budget = pairBudget;
+    };
+
+    void closest(int index, const QPointF& p, Closest& best) const {
+        const Node& node = nodes[index];
+        if (node.box.distance2(p) >= best.distance2) {
+            return;
+        }
+        if (node.piece >= 0) {
+            const Piece& piece = pieces[node.piece];
+            closestOnPiece(piece, &controls[piece.first], 0, 1, p, 0, best);
+            return;
+        }
+        // * nearer child first, the farther one is often pruned then
+        int first = node.left, second = node.right;
+        if (nodes[second].box.distance2(p) < nodes[first].box.distance2(p)) {
+            std::swap(first, second);
+        }
+        closest(first, p, best);
+        closest(second, p, best);
+    }
+
+    void closestOnPiece(const Piece& piece, const QPointF* c, double u0, double u1, const QPointF& p, int depth, Closest& best) const {
+        const int degree = path.degree();
+        if (Box::of(c, degree + 1).distance2(p) >= best.distance2) {
+            return;
+        }
+        if (depth < maxDepth && !isFlat(c, degree)) {
+            QVarLengthArray<QPointF, 16> left(degree + 1), right(degree + 1);
+            split(c, degree, 0.5, left.data(), right.data());
+            double middle = (u0 + u1) / 2;
+            QPointF dl = left[0] - p, dr = right[degree] - p;
+            if (dl.x() * dl.x() + dl.y() * dl.y() <= dr.x() * dr.x() + dr.y() * dr.y()) {
+                closestOnPiece(piece, left.data(), u0, middle, p, depth + 1, best);
+                closestOnPiece(piece, right.data(), middle, u1, p, depth + 1, best);
+            } else {
+                closestOnPiece(piece, right.data(), middle, u1, p, depth + 1, best);
+                closestOnPiece(piece, left.data(), u0, middle, p, depth + 1, best);
+            }
+            return;
+        }
+        // * projection on the chord, then Newton on (B(u) - p) . B'(u) = 0 within the piece
+        QPointF chord = c[degree] - c[0];
+        double chordLength2 = chord.x() * chord.x() + chord.y() * chord.y();
+        double u = chordLength2 > 0 ? QPointF::dotProduct(p - c[0], chord) / chordLength2 : 0.5;
+        u = std::min(std::max(u, 0.0), 1.0);
+        QPointF point, d1, d2;
+        for (int i = 0; i < 8; ++i) {
+            evaluate(c, degree, u, point, d1, d2);
+            QPointF d = point - p;
+            double g = QPointF::dotProduct(d, d1);
+            double dg = QPointF::dotProduct(d1, d1) + QPointF::dotProduct(d, d2);
+            if (dg <= 0) {
+                break;
+            }
+            double next = std::min(std::max(u - g / dg, 0.0), 1.0);
+            if (std::abs(next - u) < 1e-12) {
+                break;
+            }
+            u = next;
+        }
+        evaluate(c, degree, u, point, d1, d2);
+        QPointF d = point - p;
+        double distance2 = d.x() * d.x() + d.y() * d.y();
+        if (distance2 < best.distance2) {
+            best = {distance2, pathT(piece, u0 + u * (u1 - u0)), point};
+        }
+    }
+
+    void crossings(int index, const Line& line, std::vector<double>& ts) const {
+        const Node& node = nodes[index];
+        if (!mayCross(&node.box, line)) {
+            return;
+        }
+        if (node.piece >= 0) {
+            const Piece& piece = pieces[node.piece];
+            crossingsOnPiece(piece, &controls[piece.first], 0, 1, line, 0, ts);
+            return;
+        }
+        crossings(node.left, line, ts);
+        crossings(node.right, line, ts);
+    }
+
+    // * can a box be hit: the line leaves its corners on both sides, and a ray does not point away
+    static bool mayCross(const Box* box, const Line& line) {
+        QPointF corners[4] = {{box->x0, box->y0}, {box->x1, box->y0}, {box->x0, box->y1}, {box->x1, box->y1}};
+        return mayCross(corners, 4, line);
+    }
+
+    static bool mayCross(const QPointF* p, int count, const Line& line) {
+        bool below = false, above = false, ahead = !line.ray;
+        for (int k = 0; k < count; ++k) {
+            QPointF d = p[k] - line.origin;
+            double side = QPointF::dotProduct(d, line.normal);
+            below = below || side <= 0;
+            above = above || side >= 0;
+            ahead = ahead || QPointF::dotProduct(d, line.direction) >= 0;
+        }
+        return below && above && ahead;
+    }
+
+    // * sign changes along the control polygon's distances to the line through origin with that normal:
+    // * the curve crosses the line at most that many times (variation diminishing)
+    static int signChanges(const QPointF* p, int count, const QPointF& origin, const QPointF& normal) {
+        int changes = 0;
+        double previous = 0;
+        for (int k = 0; k < count; ++k) {
+            double side = QPointF::dotProduct(p[k] - origin, normal);
+            if (side != 0) {
+                changes += previous != 0 && (side < 0) != (previous < 0);
+                previous = side;
+            }
+        }
+        return changes;
+    }
+
+    void crossingsOnPiece(const Piece& piece, const QPointF* c, double u0, double u1, const Line& line, int depth, std::vector<double>& ts) const {
+        const int degree = path.degree();
+        if (!mayCross(c, degree + 1, line)) {
+            return;
+        }
+        double f0 = QPointF::dotProduct(c[0] - line.origin, line.normal);
+        double f1 = QPointF::dotProduct(c[degree] - line.origin, line.normal);
+        // * one sign change with the ends on both sides: exactly one root here
+        bool single = signChanges(c, degree + 1, line.origin, line.normal) == 1 && (f0 <= 0) != (f1 <= 0);
+        if (depth < maxDepth && !single) {
+            QVarLengthArray<QPointF, 16> left(degree + 1), right(degree + 1);
+            split(c, degree, 0.5, left.data(), right.data());
+            double middle = (u0 + u1) / 2;
+            crossingsOnPiece(piece, left.data(), u0, middle, line, depth + 1, ts);
+            crossingsOnPiece(piece, right.data(), middle, u1, line, depth + 1, ts);
+            return;
+        }
+        // * Newton on normal . (B(u) - origin) = 0 from where the chord crosses, kept inside the bracket
+        double lo = 0, hi = 1;
+        double u = f0 != f1 ? std::min(std::max(f0 / (f0 - f1), 0.0), 1.0) : 0.5;
+        QPointF point, d1, d2;
+        for (int i = 0; i < 32; ++i) {
+            evaluate(c, degree, u, point, d1, d2);
+            double f = QPointF::dotProduct(point - line.origin, line.normal);
+            if (f == 0) {
+                break;
+            }
+            ((f < 0) == (f0 < 0) ? lo : hi) = u;
+            double df = QPointF::dotProduct(d1, line.normal);
+            double next = df != 0 ? u - f / df : lo - 1;
+            if (next <= lo || next >= hi) {
+                next = (lo + hi) / 2; // * bisection when Newton leaves the bracket
+            }
+            if (std::abs(next - u) < 1e-14) {
+                break;
+            }
+            u = next;
+        }
+        evaluate(c, degree, u, point, d1, d2);
+        double scale = std::hypot(line.normal.x(), line.normal.y());
+        if (std::abs(QPointF::dotProduct(point - line.origin, line.normal)) <= epsilon * scale
+            && (!line.ray || QPointF::dotProduct(point - line.origin, line.direction) >= 0)) {
+            ts.push_back(pathT(piece, u0 + u * (u1 - u0)));
+        }
+    }
+
+    void intersectNodes(int a, const CurveQueries& other, int b, Search& search) const {
+        const Node& na = nodes[a];
+        const Node& nb = other.nodes[b];
+        if (!na.box.overlaps(nb.box, std::max(epsilon, other.epsilon))) {
+            return;
+        }
+        if (na.piece >= 0 && nb.piece >= 0) {
+            const Piece& pa = pieces[na.piece];
+            const Piece& pb = other.pieces[nb.piece];
+            intersectPieces(pa, &controls[pa.first], 0, 1, other, pb, &other.controls[pb.first], 0, 1, 0, search);
+        } else if (nb.piece >= 0 || (na.piece < 0 && na.box.size() >= nb.box.size())) {
+            // * descend into the bigger box
+            intersectNodes(na.left, other, b, search);
+            intersectNodes(na.right, other, b, search);
+        } else {
+            intersectNodes(a, other, nb.left, search);
+            intersectNodes(a, other, nb.right, search);
+        }
+    }
+
+    void intersectPieces(const Piece& pa, const QPointF* a, double a0, double a1,
+                         const CurveQueries& other, const Piece& pb, const QPointF* b, double b0, double b1,
+                         int depth, Search& search) const {
+        if (search.budget <= 0 || int(search.hits.size()) >= maxHits) {
+            return;
+        }
+        --search.budget;
+        const int da = path.degree(), db = other.path.degree();
+        Box boxA = Box::of(a, da + 1), boxB = Box::of(b, db + 1);
+        if (!boxA.overlaps(boxB, std::max(epsilon, other.epsilon))) {
+            return;
+        }
+        bool flatA = isFlat(a, da), flatB = isFlat(b, db);
+        bool flat = flatA && flatB;
+        double sa0, sa1, sb0, sb1;
+        if (flat && coincide(a, da, b, db, std::max(epsilon, other.epsilon), sa0, sa1, sb0, sb1)) {
+            search.overlaps.push_back({pathT(pa, a0 + sa0 * (a1 - a0)), pathT(pa, a0 + sa1 * (a1 - a0)),
+                                       other.pathT(pb, b0 + sb0 * (b1 - b0)), other.pathT(pb, b0 + sb1 * (b1 - b0))});
+            return;
+        }
+        // * both nearly straight and each crossing the other's chord at most once: a single crossing at most.
+        // * Near tangency that may never happen, there the pieces stop at 1e-7 of the curves' size
+        int changesA = flat ? signChanges(a, da + 1, b[0], QPointF(b[0].y() - b[db].y(), b[db].x() - b[0].x())) : 2;
+        int changesB = flat ? signChanges(b, db + 1, a[0], QPointF(a[0].y() - a[da].y(), a[da].x() - a[0].x())) : 2;
+        bool last = depth >= 2 * maxDepth || std::max(boxA.size(), boxB.size()) <= 1e-7 * std::max(extent, other.extent);
+        if ((changesA <= 1 && changesB <= 1) || last) {
+            double s, t;
+            if (newton(a, da, other, b, db, s, t)) {
+                search.hits.push_back({pathT(pa, a0 + s * (a1 - a0)), other.pathT(pb, b0 + t * (b1 - b0))});
+                return;
+            }
+            if (last) {
+                return;
+            }
+            // * Newton missed: keep halving, the crossing (if any) gets easier to reach
+        }
+
+        // * halve the piece that is not straight yet, or the bigger one
+        bool splitA = flatA == flatB ? boxA.size() >= boxB.size() : !flatA;
+        if (splitA) {
+            QVarLengthArray<QPointF, 16> left(da + 1), right(da + 1);
+            split(a, da, 0.5, left.data(), right.data());
+            double middle = (a0 + a1) / 2;
+            intersectPieces(pa, left.data(), a0, middle, other, pb, b, b0, b1, depth + 1, search);
+            intersectPieces(pa, right.data(), middle, a1, other, pb, b, b0, b1, depth + 1, search);
+        } else {
+            QVarLengthArray<QPointF, 16> left(db + 1), right(db + 1);
+            split(b, db, 0.5, left.data(), right.data());
+            double middle = (b0 + b1) / 2;
+            intersectPieces(pa, a, a0, a1, other, pb, left.data(), b0, middle, depth + 1, search);
+            intersectPieces(pa, a, a0, a1, other, pb, right.data(), middle, b1, depth + 1, search);
+        }
+    }
+
+    // * two straight pieces on one line along a common stretch, e.g. a curve against itself or two
+    // * collinear segments: the stretch in piece parameters, [sa0; sa1] on a and [sb0; sb1] on b.
+    // * Distances along a's chord pick the points; a few of them must coincide within tolerance
+    static bool coincide(const QPointF* a, int da, const QPointF* b, int db, double tolerance,
+                         double& sa0, double& sa1, double& sb0, double& sb1) {
+        QPointF axis = a[da] - a[0], eb = b[db] - b[0];
+        double length2 = QPointF::dotProduct(axis, axis);
+        // * chords about parallel (within some 10 degrees), b running one way along the axis
+        if (length2 == 0 || std::abs(axis.x() * eb.y() - axis.y() * eb.x()) > 0.2 * std::sqrt(length2 * QPointF::dotProduct(eb, eb))) {
+            return false;
+        }
+        bool forward = true, backward = true;
+        for (int k = 0; k < db; ++k) {
+            double step = QPointF::dotProduct(b[k + 1] - b[k], axis);
+            forward = forward && step >= 0;
+            backward = backward && step <= 0;
+        }
+        if (!forward && !backward) {
+            return false;
+        }
+        // * a spans [0; length2] along the (unnormalized) axis
+        double pb0 = QPointF::dotProduct(b[0] - a[0], axis), pb1 = QPointF::dotProduct(b[db] - a[0], axis);
+        double lo = std::max(0.0, std::min(pb0, pb1)), hi = std::min(length2, std::max(pb0, pb1));
+        if (hi - lo <= 1e-9 * length2) {
+            return false; // * apart, or touching at one point: a crossing, if anything
+        }
+        const int checks = 5;
+        for (int i = 0; i < checks; ++i) {
+            double along = lo + (hi - lo) * i / (checks - 1);
+            double sa = parameterAlong(a, da, a[0], axis, along), sb = parameterAlong(b, db, a[0], axis, along);
+            QPointF pointA, pointB, d1, d2;
+            evaluate(a, da, sa, pointA, d1, d2);
+            evaluate(b, db, sb, pointB, d1, d2);
+            if (std::hypot(pointA.x() - pointB.x(), pointA.y() - pointB.y()) > tolerance) {
+                return false;
+            }
+            if (i == 0) {
+                sa0 = sa;
+                sb0 = sb;
+            } else if (i == checks - 1) {
+                sa1 = sa;
+                sb1 = sb;
+            }
+        }
+        return true;
+    }
+
+    // * u where the piece is `along` from origin in the axis direction; the piece must run one way along it
+    static double parameterAlong(const QPointF* c, int degree, const QPointF& origin, const QPointF& axis, double along) {
+        bool rising = QPointF::dotProduct(c[degree] - c[0], axis) >= 0;
+        double lo = 0, hi = 1;
+        QPointF point, d1, d2;
+        for (int i = 0; i < 52; ++i) {
+            double u = (lo + hi) / 2;
+            evaluate(c, degree, u, point, d1, d2);
+            ((QPointF::dotProduct(point - origin, axis) < along) == rising ? lo : hi) = u;
+        }
+        return (lo + hi) / 2;
+    }
+
+    // * A(s) = B(t) for two pieces: Newton from where the chords cross, s and t kept in [0; 1]
+    bool newton(const QPointF* a, int da, const CurveQueries& other, const QPointF* b, int db, double& s, double& t) const {
+        QPointF ea = a[da] - a[0], eb = b[db] - b[0], d0 = b[0] - a[0];
+        double cross = ea.x() * eb.y() - ea.y() * eb.x();
+        s = 0.5;
+        t = 0.5;
+        if (cross != 0) {
+            s = std::min(std::max((d0.x() * eb.y() - d0.y() * eb.x()) / cross, 0.0), 1.0);
+            t = std::min(std::max((d0.x() * ea.y() - d0.y() * ea.x()) / cross, 0.0), 1.0);
+        }
+        QPointF pointA, dA, d2A, pointB, dB, d2B;
+        for (int i = 0; i < 8; ++i) {
+            evaluate(a, da, s, pointA, dA, d2A);
+            evaluate(b, db, t, pointB, dB, d2B);
+            QPointF f = pointA - pointB;
+            // * J = [dA, -dB]
+            double det = -dA.x() * dB.y() + dA.y() * dB.x();
+            if (det == 0) {
+                break;
+            }
+            double ds = (-f.x() * dB.y() + f.y() * dB.x()) / det;
+            double dt = (dA.x() * f.y() - dA.y() * f.x()) / det;
+            double nextS = std::min(std::max(s - ds, 0.0), 1.0), nextT = std::min(std::max(t - dt, 0.0), 1.0);
+            if (std::abs(nextS - s) < 1e-14 && std::abs(nextT - t) < 1e-14) {
+                break;
+            }
+            s = nextS;
+            t = nextT;
+        }
+        evaluate(a, da, s, pointA, dA, d2A);
+        evaluate(b, db, t, pointB, dB, d2B);
+        QPointF f = pointA - pointB;
+        return std::hypot(f.x(), f.y()) <= std::max(epsilon, other.epsilon);
+    }
+
+    BezierPath path;
+    std::vector<Piece> pieces;
+    std::vector<QPointF> controls;
+    std::vector<Node> nodes; // * nodes[0] is the root
+    double extent = 1; // * diagonal of the whole curve's box
+    double epsilon = 1e-9; // * how close counts as on the curve, relative to its size
+};
+
+// * text labels rasterized once at a few sizes (mip levels, each twice the previous) into one atlas image.
+// * A label of any size is the nearest level that is not smaller, scaled down with filtering:
+// * no font set up, no shaping and no glyph rasterization per frame, whatever the size animation does
+class LabelCache {
+public:
+    // * levels: pixel sizes basePixelSize, 2 * basePixelSize, ... (device pixels)
+    explicit LabelCache(const QFont& font = QFont(), QColor color = Qt::black, int basePixelSize = 24, int levels = 4)
+        : font(font), color(color), basePixelSize(basePixelSize), levelCount(levels) {}
+
+    int add(const QString& text) {
+        Label label;
+        for (int level = 0; level < levelCount; ++level) {
+            QFont levelFont(font);
+            levelFont.setPixelSize(basePixelSize << level);
+            QRectF bounds = QFontMetricsF(levelFont).boundingRect(text);
+            // * padding keeps the filtering from picking up the neighbours
+            QRect cell = allocate(int(std::ceil(bounds.width())) + 2 * padding, int(std::ceil(bounds.height())) + 2 * padding);
+
+            QPainter painter(&atlas);
+            painter.setRenderHint(QPainter::TextAntialiasing);
+            painter.setFont(levelFont);
+            painter.setPen(color);
+            // * the text origin (left end of the baseline) inside the cell
+            QPointF origin(cell.x() + padding - bounds.x(), cell.y() + padding - bounds.y());
+            painter.drawText(origin, text);
+
+            label.levels.push_back({QRectF(cell), QPointF(cell.x(), cell.y()) - origin});
+        }
+        labels.push_back(label);
+        return int(labels.size()) - 1;
+    }
+
+    // * bounds relative to the text origin at the given pixel size, like QFontMetricsF::boundingRect()
+    QRectF boundingRect(int id, double pixelSize) const {
+        const Level& level = labels[id].levels.back();
+        double scale = pixelSize / (basePixelSize << (levelCount - 1));
+        return QRectF(level.offset * scale, level.source.size() * scale)
+            .adjusted(padding * scale, padding * scale, -padding * scale, -padding * scale);
+    }
+
+    // * same placement as painter.drawText(origin, text) with a font of pixelSize;
+    // * devicePixelRatio picks the level for the real resolution of the target
+    void draw(QPainter& painter, int id, QPointF origin, double pixelSize, double devicePixelRatio = 1.0) const {
+        const Label& label = labels[id];
+        int level = 0;
+        while (level + 1 < levelCount && (basePixelSize << level) < pixelSize * devicePixelRatio) {
+            ++level;
+        }
+        const Level& chosen = label.levels[level];
+        double scale = pixelSize / (basePixelSize << level);
+        painter.drawImage(QRectF(origin + chosen.offset * scale, chosen.source.size() * scale), atlas, chosen.source);
+    }
+
+private:
+    struct Level {
+        QRectF source; // * cell in the atlas
+        QPointF offset; // * top left of the cell relative to the text origin
+    };
+    struct Label {
+        std::vector<Level> levels;
+    };
+
+    // * shelf packing: cells go left to right, a new shelf when the row is full, the atlas grows down
+    QRect allocate(int width, int height) {
+        const int atlasWidth = std::max(1024, width);
+        if (shelfX + width > atlasWidth) {
+            shelfY += shelfHeight;
+            shelfX = 0;
+            shelfHeight = 0;
+        }
+        if (atlas.isNull() || atlas.width() < atlasWidth || shelfY + height > atlas.height()) {
+            QImage grown(atlasWidth, std::max(2 * atlas.height(), shelfY + height), QImage::Format_ARGB32_Premultiplied);
+            grown.fill(Qt::transparent);
+            if (!atlas.isNull()) {
+                QPainter painter(&grown);
+                painter.setCompositionMode(QPainter::CompositionMode_Source);
+                painter.drawImage(0, 0, atlas);
+            }
+            atlas = grown;
+        }
+        QRect cell(shelfX, shelfY, width, height);
+        shelfX += width;
+        shelfHeight = std::max(shelfHeight, height);
+        return cell;
+    }
+
+    static const int padding = 2;
+
+    QFont font;
+    QColor color;
+    int basePixelSize;
+    int levelCount;
+    std::vector<Label> labels;
+    QImage atlas;
+    int shelfX = 0, shelfY = 0, shelfHeight = 0;
+};
+
+// * 4 floats at once: SSE2 / NEON, otherwise a plain loop the compiler is free to vectorize itself
+#if defined(__SSE2__) || defined(_M_X64)
+struct Float4 {
+    __m128 v;
+    static Float4 load(const float* p) { return {_mm_loadu_ps(p)}; }
+    static Float4 broadcast(float x) { return {_mm_set1_ps(x)}; }
+    void store(float* p) const { _mm_storeu_ps(p, v); }
+    Float4 operator+(Float4 o) const { return {_mm_add_ps(v, o.v)}; }
+    Float4 operator*(Float4 o) const { return {_mm_mul_ps(v, o.v)}; }
+};
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+struct Float4 {
+    float32x4_t v;
+    static Float4 load(const float* p) { return {vld1q_f32(p)}; }
+    static Float4 broadcast(float x) { return {vdupq_n_f32(x)}; }
+    void store(float* p) const { vst1q_f32(p, v); }
+    Float4 operator+(Float4 o) const { return {vaddq_f32(v, o.v)}; }
+    Float4 operator*(Float4 o) const { return {vmulq_f32(v, o.v)}; }
+};
+#else
+struct Float4 {
+    float v[4];
+    static Float4 load(const float* p) { return {{p[0], p[1], p[2], p[3]}}; }
+    static Float4 broadcast(float x) { return {{x, x, x, x}}; }
+    void store(float* p) const { for (int i = 0; i < 4; ++i) p[i] = v[i]; }
+    Float4 operator+(Float4 o) const { return {{v[0] + o.v[0], v[1] + o.v[1], v[2] + o.v[2], v[3] + o.v[3]}}; }
+    Float4 operator*(Float4 o) const { return {{v[0] * o.v[0], v[1] * o.v[1], v[2] * o.v[2], v[3] * o.v[3]}}; }
+};
+#endif
+
+// * lots of sprites moving along cubic chains. Everything per sprite lives in separate arrays
+// * (structure of arrays), so one tick is a few straight passes over memory, 4 sprites at a time:
+// * t += speed * step, a scalar fix-up for the few sprites that crossed into the next segment,
+// * then ((a * u + b) * u + c) * u + d with the coefficients of each sprite's current segment.
+// * Drawing splats all sprites into one image, the painter gets a single drawImage()
+class SpriteAnimator {
+public:
+    // * cubic chains only (BezierPath::cubicChain), returns the index to pass to addSprite()
+    int addPath(const BezierPath& path) {
+        Q_ASSERT(path.degree() == 3);
+        paths.push_back({int(segments.size()), path.segmentCount()});
+        for (int i = 0; i < path.segmentCount(); ++i) {
+            const QPointF* p = path.segment(i);
+            // * Bezier -> power basis
+            QPointF a = p[3] - 3 * p[2] + 3 * p[1] - p[0];
+            QPointF b = 3 * (p[2] - 2 * p[1] + p[0]);
+            QPointF c = 3 * (p[1] - p[0]);
+            segments.push_back({float(a.x()), float(b.x()), float(c.x()), float(p[0].x()),
+                                float(a.y()), float(b.y()), float(c.y()), float(p[0].y())});
+        }
+        return int(paths.size()) - 1;
+    }
+
+    // * t - start position on the path, [0; 1]; speed - share of the path per unit of step
+    void addSprite(int pathIndex, float pathT, float pathSpeed) {
+        const Path& p = paths[pathIndex];
+        float local = std::min(std::max(pathT, 0.0f), 1.0f) * p.segmentCount;
+        int index = std::min(int(local), p.segmentCount - 1);
+        t.push_back(local - index);
+        speed.push_back(pathSpeed * p.segmentCount); // * segments have equal shares of t
+        path.push_back(pathIndex);
+        segment.push_back(index);
+        for (std::vector<float>* v : {&ax, &bx, &cx, &dx, &ay, &by, &cy, &dy, &x, &y}) {
+            v->push_back(0);
+        }
+        loadSegment(t.size() - 1);
+        evaluate(t.size() - 1, t.size());
+    }
+
+    void clearSprites() {
+        for (std::vector<float>* v : {&t, &speed, &ax, &bx, &cx, &dx, &ay, &by, &cy, &dy, &x, &y}) {
+            v->clear();
+        }
+        path.clear();
+        segment.clear();
+    }
+
+    size_t size() const { return t.size(); }
+    QPointF position(size_t i) const { return QPointF(x[i], y[i]); }
+
+    // * moves every sprite by speed * step, sprites leaving the end of their path start over
+    void advance(float step) {
+        const size_t n = t.size();
+        const Float4 s = Float4::broadcast(step);
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4) {
+            (Float4::load(&t[i]) + Float4::load(&speed[i]) * s).store(&t[i]);
+        }
+        for (; i < n; ++i) {
+            t[i] += speed[i] * step;
+        }
+
+        // * rare: a sprite moves to the next segment about once per segmentCount / speed steps
+        for (i = 0; i < n; ++i) {
+            if (t[i] >= 1.0f || t[i] < 0.0f) {
+                const Path& p = paths[path[i]];
+                float whole = std::floor(t[i]);
+                t[i] -= whole;
+                segment[i] = ((segment[i] + int(whole)) % p.segmentCount + p.segmentCount) % p.segmentCount;
+                loadSegment(i);
+            }
+        }
+        evaluate(0, n);
+    }
+
+    // * clears the image and draws every sprite as a size x size square, centered on its position
+    void render(QImage& target, QRgb color, int size) const {
+        target.fill(Qt::transparent);
+        const int w = target.width(), h = target.height();
+        const float half = size * 0.5f;
+        for (size_t i = 0; i < t.size(); ++i) {
+            int left = int(std::lround(x[i] - half)), top = int(std::lround(y[i] - half));
+            int x0 = std::max(left, 0), x1 = std::min(left + size, w);
+            int y0 = std::max(top, 0), y1 = std::min(top + size, h);
+            for (int row = y0; row < y1; ++row) {
+                QRgb* line = reinterpret_cast<QRgb*>(target.scanLine(row));
+                std::fill(line + x0, line + std::max(x0, x1), color);
+            }
+        }
+    }
+
+private:
+    // * power basis of one segment: P(u) = ((a * u + b) * u + c) * u + d
+    struct Segment {
+        float ax, bx, cx, dx, ay, by, cy, dy;
+    };
+    struct Path {
+        int firstSegment;
+        int segmentCount;
+    };
+
+    void loadSegment(size_t i) {
+        const Segment& s = segments[paths[path[i]].firstSegment + segment[i]];
+        ax[i] = s.ax; bx[i] = s.bx; cx[i] = s.cx; dx[i] = s.dx;
+        ay[i] = s.ay; by[i] = s.by; cy[i] = s.cy; dy[i] = s.dy;
+    }
+
+    void evaluate(size_t from, size_t to) {
+        size_t i = from;
+        for (; i + 4 <= to; i += 4) {
+            Float4 u = Float4::load(&t[i]);
+            (((Float4::load(&ax[i]) * u + Float4::load(&bx[i])) * u + Float4::load(&cx[i])) * u + Float4::load(&dx[i])).store(&x[i]);
+            (((Float4::load(&ay[i]) * u + Float4::load(&by[i])) * u + Float4::load(&cy[i])) * u + Float4::load(&dy[i])).store(&y[i]);
+        }
+        for (; i < to; ++i) {
+            x[i] = ((ax[i] * t[i] + bx[i]) * t[i] + cx[i]) * t[i] + dx[i];
+            y[i] = ((ay[i] * t[i] + by[i]) * t[i] + cy[i]) * t[i] + dy[i];
+        }
+    }
+
+    std::vector<Segment> segments;
+    std::vector<Path> paths;
+
+    // * per sprite
+    std::vector<float> t; // * parameter inside the current segment, [0; 1)
+    std::vector<float> speed; // * per unit of step, in segment parameter units
+    std::vector<int> path;
+    std::vector<int> segment;
+    std::vector<float> ax, bx, cx, dx, ay, by, cy, dy; // * copy of the current segment, so evaluation never gathers
+    std::vector<float> x, y;
+};
+
+// * real time cut into fixed simulation steps. Every frame asks how many steps became due since the
+// * previous one and simulates exactly those, so the motion does not depend on when frames arrive;
+// * alpha() is how far real time already is into the next step, for interpolating what is drawn.
+// * A very late frame (a stall, a hidden window) runs at most maxSteps, the rest of the gap is dropped
+class AnimationClock {
+public:
+    explicit AnimationClock(double stepSeconds = 0.01, int maxSteps = 25)
+        : stepSeconds(stepSeconds), maxSteps(maxSteps) {}
+
+    // * steps due since the previous call, the first call starts the clock
+    int advance() {
+        if (!timer.isValid()) {
+            timer.start();
+            last = 0;
+        }
+        qint64 now = timer.nsecsElapsed();
+        accumulated += (now - last) * 1e-9;
+        last = now;
+
+        int steps = int(accumulated / stepSeconds);
+        accumulated -= steps * stepSeconds;
+        return std::min(steps, maxSteps);
+    }
+
+    // * [0; 1): share of the current step already elapsed
+    double alpha() const { return accumulated / stepSeconds; }
+    double step() const { return stepSeconds; }
+
+private:
+    QElapsedTimer timer;
+    qint64 last = 0;
+    double accumulated = 0;
+    double stepSeconds;
+    int maxSteps;
+};
 
 class BezierCurveWidget : public QWidget {
     Q_OBJECT
 
 public:
-    BezierCurveWidget(QWidget* parent = nullptr) : QWidget(parent), t(0.0), speed(0.001) {
-        timer = new QTimer(this);
-        // * коннектим сигнал таймера к слоту для обновления позиции
-        // connect(timer, &QTimer::timeout, this, &BezierCurveWidget::updatePosition); // * this works as well
-        connect(timer, SIGNAL(timeout()), this, SLOT(updatePosition()));
-        timer->start(10); // * repaint interval in ms
+    BezierCurveWidget(QWidget* parent = nullptr) : QWidget(parent), t(0.0), previousT(0.0), shownT(0.0), speed(0.001) {
+        // * bezier curve points
+
+        // * very basic
+        // curve = BezierPath::cubicChain({{50, 300}, {150, 50}, {350, 50}, {450, 300}});
+
+        //* s curve
+        curve = BezierPath::cubicChain({{50, 300}, {150, 100}, {300, 500}, {450, 200}});
+
+        // * another curve
+        // curve = BezierPath::cubicChain({{50, 300}, {150, 200}, {350, 400}, {450, 300}});
+
+        arcLength = ArcLengthTable(curve);
+        curve.sample(samplesPerSegment, samples);
+        curveId = curves.add(curve);
+        editor.addCurve(curveId);
+        queries = CurveQueries(curve);
+        bratLabel = labels.add("brat");
+
+        // * M toggles the mass mode: a crowd of sprites on copies of the curve, E the editing of the curve
+        setFocusPolicy(Qt::StrongFocus);
+        setMouseTracking(true); // * the edit mode marks the curve point closest to the mouse
+        // * paintEvent covers every pixel with the underlay, no need for Qt to clear the background first
+        setAttribute(Qt::WA_OpaquePaintEvent);
+
+        // * no timer: frames are driven by the window's update requests, see showEvent()
     }
 
     void setSpeed(double _speed) {
         speed = _speed; 
     }
 
+    void setMassMode(bool on) {
+        massMode = on;
+        if (massMode && crowd.size() == 0) {
+            buildCrowd(100000);
+        }
+        underlayDirty = true; // * the crowd's curves are part of the underlay
+        update();
+    }
+
+    // * deterministic time instead of the real clock (offscreen rendering): the state after `seconds` of
+    // * fixed steps from the start, drawn interpolated like on screen. seconds must not decrease
+    void seek(double seconds) {
+        double due = seconds / clock.step();
+        qint64 whole = qint64(std::floor(due));
+        int steps = int(std::max<qint64>(0, whole - simulatedSteps));
+        simulate(steps);
+        present(due - whole, steps > 0);
+    }
+
+    // * the current frame at the widget's size, without showing it
+    QImage renderImage() {
+        QImage image(size(), QImage::Format_ARGB32_Premultiplied);
+        QPainter painter(&image);
+        paintScene(painter);
+        return image;
+    }
+
 protected:
     void paintEvent(QPaintEvent* event) override {
-        (void)event; // * since this is not used
+        (void)event; // * since this is not used: the painter is clipped to the dirty region anyway
         
         QPainter painter(this);
+        paintScene(painter);
+    }
+
+    void paintScene(QPainter& painter) {
+        // * static layer: the curves, painted again only when the size, the pixel ratio or the mode changes
+        const double ratio = devicePixelRatioF();
+        const QSize pixelSize(qRound(width() * ratio), qRound(height() * ratio));
+        if (underlayDirty || underlay.size() != pixelSize) {
+            updateUnderlay(pixelSize, ratio);
+        }
+        painter.drawPixmap(0, 0, underlay);
+
+        if (massMode) {
+            // * the whole crowd is one image: no per sprite painter calls
+            if (crowdLayer.size() != size()) {
+                crowdLayer = QImage(size(), QImage::Format_ARGB32_Premultiplied);
+            }
+            crowd.render(crowdLayer, qRgb(0, 90, 0), 3);
+            painter.drawImage(0, 0, crowdLayer);
+        }
 
         // * smooth out the edges
         painter.setRenderHint(QPainter::Antialiasing);
+        painter.setRenderHint(QPainter::SmoothPixmapTransform); // * scaled labels
 
-        // * bezier curve points
+        Moving moving = movingAt(shownT);
 
-        // * very basic
-        // QPointF p0(50, 300);
-        // QPointF p1(150, 50);
-        // QPointF p2(350, 50);
-        // QPointF p3(450, 300);
+        painter.setPen(QPen(Qt::green, 2, Qt::SolidLine, Qt::RoundCap, Qt::RoundJoin));
+        painter.setBrush(Qt::green);
+        painter.drawRect(moving.square);
 
-        //* s curve
-        QPointF p0(50, 300);
-        QPointF p1(150, 100);
-        QPointF p2(300, 500);
-        QPointF p3(450, 200);
+        labels.draw(painter, bratLabel, moving.labelOrigin, moving.labelPixelSize, ratio);
 
-        // * another curve
-        // QPointF p0(50, 300);
-        // QPointF p1(150, 200);
-        // QPointF p2(350, 400);
-        // QPointF p3(450, 300);
+        if (editMode && snapping) {
+            painter.setPen(QPen(Qt::red, 1));
+            painter.setBrush(Qt::NoBrush);
+            painter.drawEllipse(snap, 3, 3);
+        }
+    }
 
-        // * draw the curve
-        QPainterPath path(p0);
-        path.cubicTo(p1, p2, p3);
+    void resizeEvent(QResizeEvent* event) override {
+        underlayDirty = true;
+        QWidget::resizeEvent(event);
+    }
 
-        painter.setPen(QPen(Qt::green, 2, Qt::SolidLine, Qt::RoundCap, Qt::RoundJoin));
-        painter.drawPath(path);
+    void keyPressEvent(QKeyEvent* event) override {
+        if (event->key() == Qt::Key_M) {
+            setMassMode(!massMode);
+        } else if (event->key() == Qt::Key_E) {
+            editMode = !editMode;
+            dragging = false;
+            snapping = false; // * until the mouse comes near the curve
+            underlayDirty = true; // * so are the control points
+            update();
+        } else {
+            QWidget::keyPressEvent(event);
+        }
+    }
 
-        // * curr pos of the moving obj
-        QPointF currPos = bezierPoint(p0, p1, p2, p3, t);
+    // * dragging control points in the edit mode
+    void mousePressEvent(QMouseEvent* event) override {
+        dragging = editMode && event->button() == Qt::LeftButton && editor.pick(event->pos(), 8, dragged);
+    }
+
+    void mouseMoveEvent(QMouseEvent* event) override {
+        if (!dragging) {
+            if (editMode) {
+                QRect before = snapBounds();
+                updateSnap(event->pos());
+                update(before | snapBounds());
+            }
+            return;
+        }
+        // * re-flattens only the segments of the moved point; the underlay is redrawn only where they
+        // * were and are now (pen and point markers included). The square keeps the old curve until release
+        QRect changed = editor.move(dragged, event->pos()).toAlignedRect().adjusted(-underlayMargin, -underlayMargin, underlayMargin, underlayMargin);
+        if (snapping) {
+            snapping = false; // * the BVH is of the old curve, no snapping while dragging
+            changed |= snapBounds();
+        }
+        repaintUnderlay(changed);
+        update(changed);
+    }
+
+    void mouseReleaseEvent(QMouseEvent* event) override {
+        if (dragging && dragged.curve == curveId) {
+            // * whole-curve data, rebuilt once per drag
+            curve = curves.curve(curveId);
+            arcLength = ArcLengthTable(curve);
+            curve.sample(samplesPerSegment, samples);
+            queries = CurveQueries(curve);
+            updateSnap(event->pos());
+            update(snapBounds());
+        }
+        dragging = false;
+    }
+
+    // * the frame loop: QWindow::requestUpdate() delivers UpdateRequest when the platform is ready for
+    // * the next frame (vsync paced where supported), each one simulates and asks for the next.
+    // * A window that is not exposed gets no requests, the loop restarts on the next Expose
+    void showEvent(QShowEvent* event) override {
+        if (QWindow* handle = window()->windowHandle()) {
+            handle->installEventFilter(this);
+            handle->requestUpdate();
+        }
+        QWidget::showEvent(event);
+    }
+
+    bool eventFilter(QObject* watched, QEvent* event) override {
+        QWindow* handle = window()->windowHandle();
+        if (watched == handle) {
+            if (event->type() == QEvent::UpdateRequest) {
+                advanceFrame();
+                if (handle->isExposed()) {
+                    handle->requestUpdate();
+                }
+                // * consumed: passed on, it would repaint the whole window every tick. What changed is
+                // * already scheduled by the update(rect) calls in present(), nothing at all if nothing moved
+                return true;
+            } else if (event->type() == QEvent::Expose && handle->isExposed()) {
+                handle->requestUpdate();
+            }
+        }
+        return QWidget::eventFilter(watched, event);
+    }
+
+private:
+    void advanceFrame() {
+        int steps = clock.advance();
+        simulate(steps);
+        present(clock.alpha(), steps > 0);
+    }
+
+    // * fixed steps of clock.step() seconds, speed is per step
+    void simulate(int steps) {
+        for (int i = 0; i < steps; ++i) {
+            previousT = t;
+            t += speed;
+            if (t > 1.0) {
+                t = 0.0;
+            } else if (t < 0.0) {
+                t = 1.0;
+            }
+        }
+        if (massMode && steps > 0) {
+            crowd.advance(float(speed * steps)); // * the sprites move linearly in t, one pass covers all steps
+        }
+        simulatedSteps += steps;
+    }
+
+    // * alpha - share of the next step already elapsed; stepped - whether simulate() did anything
+    void present(double alpha, bool stepped) {
+        // * draw between the last two steps; no blending across the wrap to the start
+        double next = t >= previousT ? previousT + (t - previousT) * alpha : t;
+        if (massMode) {
+            if (stepped) {
+                update(); // * the crowd is everywhere
+            }
+        } else if (next != shownT) {
+            update(movingAt(shownT).bounds | movingAt(next).bounds);  // * only where the square was and will be
+        }
+        shownT = next;
+    }
+
+    double t; // * travelled part of the curve length, [0;1]
+    double previousT; // * t one step earlier
+    double shownT; // * what is on screen: between previousT and t
+    double speed; // * animation speed, per clock step
+    AnimationClock clock;
+    qint64 simulatedSteps = 0;
+    BezierPath curve;
+    ArcLengthTable arcLength;
+    // * the curve at fixed steps of t (BezierPath::sample), the moving square is placed between two of them
+    static const int samplesPerSegment = 64;
+    std::vector<QPointF> samples;
+    CurveCache curves;
+    int curveId;
+    CurveEditor editor{curves};
+    bool editMode = false;
+    bool dragging = false;
+    CurveEditor::Handle dragged;
+    CurveQueries queries;
+    QPointF snap; // * closest point of the curve to the mouse
+    bool snapping = false; // * the mouse is within snapRadius of the curve, snap is shown
+    static constexpr double snapRadius = 20;
+    std::vector<CurveEditor::Handle> nearSegments;
+    LabelCache labels;
+    int bratLabel;
+
+    // * the square and its label at the travelled share t
+    struct Moving {
+        QRectF square;
+        QPointF labelOrigin;
+        double labelPixelSize;
+        QRect bounds; // * everything the two can touch, pen and antialiasing included
+    };
+
+    Moving movingAt(double at) const {
+        // * curr pos of the moving obj: t is the travelled share of the length, so the speed is constant
+        QPointF currPos = sampledPoint(arcLength.parameterAt(at * arcLength.length()));
 
         // * создаем коэффициент для управления размером фигуры во время движения
-        double coef = 1.0 + 2.0 * sin(acos(-1) * t);
+        double coef = 1.0 + 2.0 * sin(acos(-1) * at);
 
-        painter.setBrush(Qt::green);
+        Moving moving;
+        moving.square = QRectF(currPos.x() - 20 * coef, currPos.y() - 20 * coef, 40 * coef, 40 * coef);
+
+        // * the label comes from the atlas: 20 pt scaled with the square
+        moving.labelPixelSize = 20 * coef * logicalDpiY() / 72.0;
+        QRectF boundingRect = labels.boundingRect(bratLabel, moving.labelPixelSize);
+        moving.labelOrigin = QPointF(currPos.x() - boundingRect.width() / 2 - 2, currPos.y() + boundingRect.height() / 2);
+
+        moving.bounds = moving.square.united(boundingRect.translated(moving.labelOrigin)).toAlignedRect().adjusted(-2, -2, 2, 2);
+        return moving;
+    }
+
+    // * point at path parameter u, linear between the samples around it
+    QPointF sampledPoint(double u) const {
+        double scaled = std::min(std::max(u, 0.0), 1.0) * (samples.size() - 1);
+        size_t i = std::min(size_t(scaled), samples.size() - 2);
+        return samples[i] + (samples[i + 1] - samples[i]) * (scaled - i);
+    }
 
-        painter.drawRect(currPos.x() - 20 * coef, currPos.y() - 20 * coef, 40 * coef, 40 * coef);
+    // * hit test around the mouse: the segment grid hands out the segments whose bounds are near,
+    // * the exact closest point is looked up only if one of them belongs to the curve
+    void updateSnap(const QPointF& pos) {
+        editor.segmentsIn(QRectF(pos.x() - snapRadius, pos.y() - snapRadius, 2 * snapRadius, 2 * snapRadius), nearSegments);
+        snapping = std::any_of(nearSegments.begin(), nearSegments.end(), [&](const CurveEditor::Handle& segment) {
+            return segment.curve == curveId;
+        });
+        if (snapping) {
+            snap = queries.closestPoint(pos);
+            QPointF d = snap - pos;
+            snapping = d.x() * d.x() + d.y() * d.y() <= snapRadius * snapRadius;
+        }
+    }
 
-        painter.setPen(Qt::black);
+    QRect snapBounds() const {
+        return QRectF(snap.x() - 5, snap.y() - 5, 10, 10).toAlignedRect();
+    }
 
-        QFont font;
-        font.setPointSize(20 * coef);
-        painter.setFont(font);
+    void updateUnderlay(const QSize& pixelSize, double ratio) {
+        underlay = QPixmap(pixelSize);
+        underlay.setDevicePixelRatio(ratio);
+        underlay.fill(palette().color(QPalette::Window));
 
-        QFontMetrics metrics(font);
-        QRect boundingRect = metrics.boundingRect("brat");
+        QPainter painter(&underlay);
+        painter.setRenderHint(QPainter::Antialiasing);
 
-        int x = currPos.x() - boundingRect.width() / 2 - 2;
-        int y = currPos.y() + boundingRect.height() / 2;
+        // * draw the curve: flattened once, re-flattened only if the curve or the pixel ratio changes
+        curves.setScale(ratio);
+        painter.setPen(QPen(Qt::green, 2, Qt::SolidLine, Qt::RoundCap, Qt::RoundJoin));
+        painter.drawPolyline(curves.polyline(curveId));
+
+        if (massMode) {
+            painter.setPen(QPen(Qt::darkGreen, 1));
+            for (int id : crowdCurveIds) {
+                painter.drawPolyline(curves.polyline(id));
+            }
+        }
 
-        painter.drawText(x, y, "brat");
+        if (editMode) {
+            const std::vector<QPointF>& points = curves.curve(curveId).points();
+            painter.setPen(QPen(Qt::gray, 1, Qt::DashLine));
+            painter.drawPolyline(points.data(), int(points.size()));
+            painter.setPen(QPen(Qt::darkGray, 1));
+            painter.setBrush(Qt::white);
+            for (const QPointF& point : points) {
+                painter.drawEllipse(point, 4, 4);
+            }
+        }
+        underlayDirty = false;
     }
 
+    // * the part of the underlay inside rect (logical pixels) again: background, then the segments of the
+    // * curve and of the crowd whose bounds come near it, in the order updateUnderlay() draws them
+    void repaintUnderlay(const QRect& rect) {
+        if (underlayDirty || underlay.isNull()) {
+            return; // * the next paint redraws all of it anyway
+        }
+        QPainter painter(&underlay);
+        painter.setClipRect(rect);
+        painter.fillRect(rect, palette().color(QPalette::Window));
+        painter.setRenderHint(QPainter::Antialiasing);
 
-private slots:
-    void updatePosition() {
-        t += speed;
-        if (t > 1.0) {
-            t = 0.0;
-        } else if (t < 0.0) {
-            t = 1.0;
+        // * segments just outside rect still reach into it with the pen or a marker
+        const QRectF near = QRectF(rect).adjusted(-underlayMargin, -underlayMargin, underlayMargin, underlayMargin);
+        const QPointF* points;
+        editor.segmentsIn(near, nearSegments);
+        painter.setPen(QPen(Qt::green, 2, Qt::SolidLine, Qt::RoundCap, Qt::RoundJoin));
+        for (const CurveEditor::Handle& segment : nearSegments) {
+            if (segment.curve == curveId) {
+                int count = curves.segmentPolyline(curveId, segment.index, points);
+                painter.drawPolyline(points, count);
+            }
+        }
+
+        if (massMode) {
+            crowdIndex.segmentsIn(near, crowdSegments);
+            painter.setPen(QPen(Qt::darkGreen, 1));
+            for (const CurveEditor::Handle& segment : crowdSegments) {
+                int count = curves.segmentPolyline(segment.curve, segment.index, points);
+                painter.drawPolyline(points, count);
+            }
+        }
+
+        if (editMode) {
+            // * the control polygon of each segment: its legs, then its points
+            const BezierPath& path = curves.curve(curveId);
+            const int degree = path.degree();
+            for (const CurveEditor::Handle& segment : nearSegments) {
+                if (segment.curve == curveId) {
+                    painter.setPen(QPen(Qt::gray, 1, Qt::DashLine));
+                    painter.drawPolyline(path.segment(segment.index), degree + 1);
+                }
+            }
+            painter.setPen(QPen(Qt::darkGray, 1));
+            painter.setBrush(Qt::white);
+            for (const CurveEditor::Handle& segment : nearSegments) {
+                if (segment.curve == curveId) {
+                    for (int k = 0; k <= degree; ++k) {
+                        painter.drawEllipse(path.segment(segment.index)[k], 4, 4);
+                    }
+                }
+            }
         }
-        update();  // * start paint event
     }
 
-private:
-    double t; // * t param for bezier curve, [0;1]
-    double speed; // * animation speed
-    QTimer* timer;
+    QPixmap underlay;
+    bool underlayDirty = true;
+    static const int underlayMargin = 6; // * logical pixels beyond the segment bounds: pen width, point markers
 
-    // * calculate bezier func
-    QPointF bezierPoint(QPointF p0, QPointF p1, QPointF p2, QPointF p3, double t) {
-        double b = 1 - t;
-        QPointF point = b * b * b * p0 + 3 * b * b * t * p1 + 3 * b * t * t * p2 + t * t * t * p3;
-        // * P(t) = (1-t)^3 * P0 + 3 * (1-t)^2 * t * P1 + 3 * (1-t) * t^2 * P2 + t^3 * P3 ~ Bezier formula
-        return point;
+    // * mass mode
+    void buildCrowd(int count) {
+        // * the curve shifted up and down, sprites spread randomly over them, speeds within +-50% of the main one
+        const int pathCount = 8;
+        std::mt19937 random(42);
+        std::uniform_real_distribution<float> position(0.0f, 1.0f), speedFactor(0.5f, 1.5f);
+        for (int i = 0; i < pathCount; ++i) {
+            std::vector<QPointF> points(curve.points());
+            for (QPointF& point : points) {
+                point.ry() += (i - (pathCount - 1) * 0.5) * 30;
+            }
+            BezierPath path = BezierPath::cubicChain(points);
+            crowd.addPath(path);
+            crowdCurveIds.push_back(curves.add(path));
+            crowdIndex.addCurve(crowdCurveIds.back());
+        }
+        for (int i = 0; i < count; ++i) {
+            crowd.addSprite(i % pathCount, position(random), speedFactor(random));
+        }
     }
+
+    bool massMode = false;
+    SpriteAnimator crowd;
+    std::vector<int> crowdCurveIds;
+    CurveEditor crowdIndex{curves}; // * only to find the crowd's segments by area, never edited
+    std::vector<CurveEditor::Handle> crowdSegments;
+    QImage crowdLayer;
 };
 
 class OutputWindow : public QWidget {
@@ -144,9 +2046,271 @@ private slots:
     }
 };
 
+// * frames without a window: the animation clock is stepped by 1 / fps per frame, so the output is the
+// * same on every run and as fast as the machine allows. Frames are rendered in order on this thread and
+// * encoded on a pool; rgba writes raw frames to stdout in order (e.g. for ffmpeg -f rawvideo -pix_fmt rgba)
+static int runExport(const QStringList& arguments) {
+    QCommandLineParser parser;
+    parser.addOption({"export", "render frames headless"});
+    parser.addOption({"frames", "number of frames", "count", "600"});
+    parser.addOption({"fps", "frames per second of animation time", "rate", "60"});
+    parser.addOption({"size", "frame size", "WxH", "500x600"});
+    parser.addOption({"format", "png, ppm or rgba (raw, to stdout)", "format", "png"});
+    parser.addOption({"output", "directory for png/ppm frames", "dir", "frames"});
+    parser.addOption({"threads", "encoding threads", "count", QString::number(QThread::idealThreadCount())});
+    parser.addOption({"speed", "share of the curve per 10 ms", "value", "0.001"});
+    parser.addOption({"mass", "the mass mode crowd as well"});
+    parser.process(arguments);
+
+    const int frames = std::max(1, parser.value("frames").toInt());
+    const double fps = std::max(1.0, parser.value("fps").toDouble());
+    const QString format = parser.value("format");
+    const QStringList wh = parser.value("size").split('x');
+    if (wh.size() != 2 || (format != "png" && format != "ppm" && format != "rgba")) {
+        qWarning() << "bad size or format";
+        return 1;
+    }
+    const bool raw = format == "rgba";
+    const QDir directory(parser.value("output"));
+    if (!raw && !directory.mkpath(".")) {
+        qWarning() << "can't create" << directory.path();
+        return 1;
+    }
+
+    BezierCurveWidget widget;
+    widget.resize(wh[0].toInt(), wh[1].toInt());
+    widget.setSpeed(parser.value("speed").toDouble());
+    widget.setMassMode(parser.isSet("mass"));
+
+    QThreadPool pool;
+    pool.setMaxThreadCount(std::max(1, parser.value("threads").toInt()));
+    QFile out;
+    if (raw && !out.open(stdout, QIODevice::WriteOnly)) {
+        qWarning() << "can't write to stdout";
+        return 1;
+    }
+    std::atomic<int> failures(0);
+
+    // * encoded in parallel, written (or checked) in frame order; at most 2 frames per thread in flight
+    std::deque<QFuture<QByteArray>> pending;
+    auto finishOldest = [&]() {
+        QByteArray bytes = pending.front().result();
+        pending.pop_front();
+        if (raw && out.write(bytes) != bytes.size()) {
+            ++failures;
+        }
+    };
+
+    QElapsedTimer timer;
+    timer.start();
+    for (int frame = 0; frame < frames; ++frame) {
+        widget.seek(frame / fps);
+        QImage image = widget.renderImage();
+        QString path = directory.filePath(QString("frame_%1.%2").arg(frame, 5, 10, QChar('0')).arg(format));
+        pending.push_back(QtConcurrent::run(&pool, [image, path, raw, &failures]() {
+            if (raw) {
+                QImage rgba = image.convertToFormat(QImage::Format_RGBA8888);
+                QByteArray bytes;
+                bytes.reserve(rgba.width() * rgba.height() * 4);
+                for (int y = 0; y < rgba.height(); ++y) {
+                    bytes.append(reinterpret_cast<const char*>(rgba.constScanLine(y)), rgba.width() * 4);
+                }
+                return bytes;
+            }
+            if (!image.save(path)) {
+                qWarning() << "can't write" << path;
+                ++failures;
+            }
+            return QByteArray();
+        }));
+        if (int(pending.size()) >= 2 * pool.maxThreadCount()) {
+            finishOldest();
+        }
+    }
+    while (!pending.empty()) {
+        finishOldest();
+    }
+
+    // * summary on stderr: stdout may carry the frames
+    const double seconds = timer.nsecsElapsed() * 1e-9;
+    QJsonObject result;
+    result["frames"] = frames;
+    result["width"] = widget.width();
+    result["height"] = widget.height();
+    result["format"] = format;
+    result["seconds"] = seconds;
+    result["frames_per_second"] = frames / seconds;
+    result["realtime_factor"] = frames / fps / seconds;
+    result["failures"] = failures.load();
+    QTextStream(stderr) << QJsonDocument(result).toJson(QJsonDocument::Compact) << "\n";
+    return failures.load() == 0 ? 0 : 1;
+}
+
+// * --self-check: the curve queries and fast paths against known answers and the reference
+// * algorithms, no window needed. Prints every check and returns non-zero if any of them fails
+static int runSelfCheck() {
+    int failed = 0;
+    auto report = [&](const char* name, bool ok, double error) {
+        qInfo().noquote() << (ok ? "ok  " : "FAIL") << name << "max error" << error;
+        failed += !ok;
+    };
+    std::mt19937 random(7);
+    std::uniform_real_distribution<double> coordinate(0.0, 500.0);
+    auto randomPoints = [&](int count) {
+        std::vector<QPointF> points(count);
+        for (QPointF& point : points) {
+            point = QPointF(coordinate(random), coordinate(random));
+        }
+        return points;
+    };
+    auto distance = [](const QPointF& a, const QPointF& b) {
+        return std::hypot(a.x() - b.x(), a.y() - b.y());
+    };
+    // * the worst distance between the two curves' points at the hits
+    auto hitError = [&](const CurveQueries& a, const CurveQueries& b, const std::vector<std::pair<double, double>>& hits) {
+        double error = 0;
+        for (const auto& hit : hits) {
+            error = std::max(error, distance(a.curve().point(hit.first), b.curve().point(hit.second)));
+        }
+        return error;
+    };
+
+    // * crossing: an S curve and a straight line through its upper bump, twice, as intersectLine sees it too
+    CurveQueries wave(BezierPath::cubicChain({{0, 0}, {100, 200}, {200, -200}, {300, 0}}));
+    CurveQueries level(BezierPath::cubicChain({{-50, 10}, {100, 10}, {250, 10}, {400, 10}}));
+    std::vector<std::pair<double, double>> hits = wave.intersect(level);
+    std::vector<double> onLine = wave.intersectLine(QPointF(0, 10), QPointF(1, 0));
+    double crossingError = hitError(wave, level, hits);
+    for (size_t i = 0; i < hits.size() && i < onLine.size(); ++i) {
+        crossingError = std::max(crossingError, distance(wave.curve().point(hits[i].first), wave.curve().point(onLine[i])));
+    }
+    report("crossing: 2 hits, same as intersectLine", hits.size() == 2 && onLine.size() == 2 && crossingError < 1e-6, crossingError);
+
+    // * tangent: a bowl touching y = 0 at (150, 0) from above, found there and only there
+    CurveQueries bowl(BezierPath::cubicChain({{0, 90}, {100, -30}, {200, -30}, {300, 90}}));
+    CurveQueries ground(BezierPath::cubicChain({{0, 0}, {100, 0}, {200, 0}, {300, 0}}));
+    hits = bowl.intersect(ground);
+    double tangentError = 0;
+    for (const auto& hit : hits) {
+        tangentError = std::max({tangentError, std::abs(hit.first - 0.5), std::abs(hit.second - 0.5)});
+    }
+    report("tangent: touching point only", !hits.empty() && hits.size() <= 4 && tangentError < 1e-3, tangentError);
+
+    // * overlap: two cubics on y = 0, x 0..300 and 50..400, share x 50..300: one stretch, not a pile of hits
+    CurveQueries shifted(BezierPath::cubicChain({{50, 0}, {200, 0}, {250, 0}, {400, 0}}));
+    std::vector<CurveQueries::Overlap> overlaps;
+    QElapsedTimer timer;
+    timer.start();
+    hits = ground.intersect(shifted, &overlaps);
+    double overlapError = 0;
+    if (overlaps.size() == 1) {
+        const CurveQueries::Overlap& o = overlaps[0];
+        overlapError = std::max({distance(ground.curve().point(o.from), QPointF(50, 0)), distance(ground.curve().point(o.to), QPointF(300, 0)),
+                                 distance(shifted.curve().point(o.otherFrom), QPointF(50, 0)), distance(shifted.curve().point(o.otherTo), QPointF(300, 0))});
+    }
+    report("overlap: one shared stretch, x 50..300", overlaps.size() == 1 && hits.size() == 2 && overlapError < 1e-6 && timer.elapsed() < 1000, overlapError);
+
+    // * a curve with a loop against itself: the whole curve is shared, plus the loop's crossing both ways
+    CurveQueries loop(BezierPath::cubicChain({{0, 0}, {300, 200}, {-100, 200}, {200, 0}}));
+    hits = loop.intersect(loop, &overlaps);
+    bool whole = overlaps.size() == 1 && overlaps[0].from < 1e-9 && overlaps[0].to > 1 - 1e-9
+                 && overlaps[0].otherFrom < 1e-9 && overlaps[0].otherTo > 1 - 1e-9;
+    int crossings = 0;
+    for (const auto& hit : hits) {
+        crossings += std::abs(hit.first - hit.second) > 1e-6;
+    }
+    report("self: whole curve shared, loop crossed twice", whole && crossings == 2 && hits.size() == 4, hitError(loop, loop, hits));
+
+    // * closest point against a dense scan of the curve, random curves and points
+    double closestError = 0;
+    for (int i = 0; i < 50; ++i) {
+        BezierPath path = BezierPath::cubicChain(randomPoints(7));
+        CurveQueries queries(path);
+        QPointF p(coordinate(random), coordinate(random));
+        double scanned = std::numeric_limits<double>::infinity();
+        for (int k = 0; k <= 20000; ++k) {
+            scanned = std::min(scanned, distance(p, path.point(k / 20000.0)));
+        }
+        closestError = std::max(closestError, distance(p, queries.closestPoint(p)) - scanned);
+    }
+    report("closest point vs scan", closestError < 1e-3, closestError);
+
+    // * Bernstein table sampling == De Casteljau at the same t, single curves of degree 1..12 and cubic chains
+    double sampleError = 0;
+    for (int degree = 1; degree <= 12; ++degree) {
+        for (const BezierPath& path : {BezierPath::bezier(randomPoints(degree + 1)), BezierPath::cubicChain(randomPoints(3 * degree + 1))}) {
+            std::vector<QPointF> samples;
+            path.sample(37, samples);
+            for (size_t j = 0; j < samples.size(); ++j) {
+                sampleError = std::max(sampleError, distance(samples[j], path.point(double(j) / (samples.size() - 1))));
+            }
+        }
+    }
+    report("Bernstein table sampling vs De Casteljau", sampleError < 1e-9, sampleError);
+
+    // * uniform B-spline converted to Bezier segments == Cox-de Boor on the knots 0, 1, 2, ...
+    double splineError = 0;
+    for (int degree = 1; degree <= 5; ++degree) {
+        std::vector<QPointF> points = randomPoints(degree + 9);
+        BezierPath path = BezierPath::uniformBSpline(points, degree);
+        const int first = degree, last = int(points.size()); // * the spline lives on [degree; points.size()]
+        for (int i = 0; i <= 200; ++i) {
+            double x = first + (last - first) * i / 200.0;
+            // * N(j, p)(x) = (x - j) / p * N(j, p - 1)(x) + (j + p + 1 - x) / p * N(j + 1, p - 1)(x)
+            std::vector<double> basis(points.size() + degree, 0.0);
+            basis[std::min(int(x), last - 1)] = 1;
+            for (int p = 1; p <= degree; ++p) {
+                for (int j = 0; j + p < int(basis.size()); ++j) {
+                    basis[j] = (x - j) / p * basis[j] + (j + p + 1 - x) / p * basis[j + 1];
+                }
+            }
+            QPointF reference;
+            for (size_t j = 0; j < points.size(); ++j) {
+                reference += basis[j] * points[j];
+            }
+            splineError = std::max(splineError, distance(reference, path.point(i / 200.0)));
+        }
+    }
+    report("uniform B-spline vs Cox-de Boor", splineError < 1e-9, splineError);
+
+    // * flattening: every chord midpoint within the tolerance of the curve
+    const double tolerance = 0.25;
+    double flattenError = 0;
+    for (int i = 0; i < 20; ++i) {
+        BezierPath path = BezierPath::cubicChain(randomPoints(7));
+        CurveQueries queries(path);
+        QPolygonF polyline;
+        CurveCache::flatten(path, tolerance, polyline);
+        for (int j = 0; j + 1 < polyline.size(); ++j) {
+            QPointF middle = (polyline[j] + polyline[j + 1]) / 2;
+            flattenError = std::max(flattenError, distance(middle, queries.closestPoint(middle)));
+        }
+    }
+    report("flattened polyline within tolerance", flattenError <= tolerance, flattenError);
+
+    qInfo() << (failed == 0 ? "all checks passed" : "some checks failed");
+    return failed == 0 ? 0 : 1;
+}
+
 int main(int argc, char** argv) {
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--self-check") == 0) {
+            return runSelfCheck();
+        }
+    }
 
+    // * --export: frames without a window; the offscreen platform must be chosen before QApplication exists
+    bool exporting = false;
+    for (int i = 1; i < argc; ++i) {
+        exporting = exporting || std::strcmp(argv[i], "--export") == 0;
+    }
+    if (exporting) {
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
     QApplication app(argc, argv);
+    if (exporting) {
+        return runExport(app.arguments());
+    }
 
     OutputWindow window;
     window.resize(500, 650);
@@ -2,6 +2,13 @@ TEMPLATE = app
 TARGET = qt_example
 INCLUDEPATH += .
 
-QT += core gui widgets
+QT += core gui widgets concurrent
 
-SOURCES += main.cpp
\ No newline at end of file
+SOURCES += main.cpp
+
+# * make check: the curve queries and fast paths against known answers, no display needed (--self-check)
+macx: TEST_BINARY = $$OUT_PWD/$${TARGET}.app/Contents/MacOS/$$TARGET
+else: TEST_BINARY = $$OUT_PWD/$$TARGET
+check.commands = $$TEST_BINARY --self-check
+check.depends = first
+QMAKE_EXTRA_TARGETS += check
\ No newline at end of file
@@ -2,129 +2,2526 @@
 #include <QWidget>
 #include <QPainter>
 #include <QTimer>
+#include <QKeyEvent>
+#include <QThread>
+#include <QThreadPool>
+#include <QtConcurrent>
+#include <QFile>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QCommandLineParser>
+#include <QJsonObject>
+#include <QJsonDocument>
+#include <QTextStream>
 #include <cmath>
 #include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <atomic>
+#include <limits>
+#include <cstring>
+#include <string>
+#include <sstream>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
 
 struct Vertex3D {
     double x, y, z;
 };
 
-struct Face {
-    std::vector<int> vertices;
+// * индексированная треугольная сетка: координаты в плоских массивах, по 3 индекса на треугольник
+struct Mesh {
+    std::vector<float> x, y, z;
+    std::vector<float> nx, ny, nz; // * нормали вершин, см. computeNormals()
+    std::vector<uint32_t> indices;
+
+    // * уровни детализации (см. buildLevels()): треугольники [firstTriangle, firstTriangle + triangleCount)
+    // * того же indices поверх тех же вершин. Уровень 0 - исходная сетка, error - насколько
+    // * уровень может отойти от нее (в единицах координат)
+    struct Level {
+        uint32_t firstTriangle;
+        uint32_t triangleCount;
+        float error;
+    };
+    std::vector<Level> levels; // * пусто -> единственный уровень из всех треугольников
+
+    uint32_t vertexCount() const { return uint32_t(x.size()); }
+    uint32_t triangleCount() const { return uint32_t(indices.size() / 3); }
+    uint32_t baseTriangleCount() const { return levels.empty() ? triangleCount() : levels[0].triangleCount; }
+
+    uint32_t addVertex(float vx, float vy, float vz) {
+        x.push_back(vx);
+        y.push_back(vy);
+        z.push_back(vz);
+        return uint32_t(x.size() - 1);
+    }
+
+    // * выпуклый многоугольник разбивается веером
+    void addPolygon(const uint32_t* polygon, size_t count) {
+        for (size_t i = 2; i < count; ++i) {
+            indices.insert(indices.end(), {polygon[0], polygon[i - 1], polygon[i]});
+        }
+    }
+
+    // * нормаль вершины - сумма ненормированных нормалей треугольников вокруг нее (вес = площадь).
+    // * Острые ребра остаются острыми, только если у граней свои вершины. Считается по уровню 0,
+    // * упрощенные уровни берут те же нормали
+    void computeNormals() {
+        nx.assign(x.size(), 0.0f);
+        ny.assign(x.size(), 0.0f);
+        nz.assign(x.size(), 0.0f);
+        for (size_t t = 0; t < size_t(baseTriangleCount()) * 3; t += 3) {
+            uint32_t a = indices[t], b = indices[t + 1], c = indices[t + 2];
+            float ux = x[b] - x[a], uy = y[b] - y[a], uz = z[b] - z[a];
+            float vx = x[c] - x[a], vy = y[c] - y[a], vz = z[c] - z[a];
+            float cx = uy * vz - uz * vy, cy = uz * vx - ux * vz, cz = ux * vy - uy * vx;
+            for (uint32_t i : {a, b, c}) {
+                nx[i] += cx;
+                ny[i] += cy;
+                nz[i] += cz;
+            }
+        }
+        for (size_t i = 0; i < x.size(); ++i) {
+            float length = std::sqrt(nx[i] * nx[i] + ny[i] * ny[i] + nz[i] * nz[i]);
+            if (length > 0) {
+                nx[i] /= length;
+                ny[i] /= length;
+                nz[i] /= length;
+            }
+        }
+    }
+};
+
+// * числа разбираются вручную: strtof зависит от локали (в русской ждет запятую)
+// * и не знает, где кончается строка
+static bool parseNumber(const char*& p, const char* end, double& value) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')) {
+        ++p;
+    }
+    bool negative = p < end && *p == '-';
+    if (p < end && (*p == '-' || *p == '+')) {
+        ++p;
+    }
+
+    double mantissa = 0;
+    int digits = 0;
+    int exponent = 0;
+    for (; p < end && *p >= '0' && *p <= '9'; ++p, ++digits) {
+        mantissa = mantissa * 10 + (*p - '0');
+    }
+    if (p < end && *p == '.') {
+        for (++p; p < end && *p >= '0' && *p <= '9'; ++p, ++digits, --exponent) {
+            mantissa = mantissa * 10 + (*p - '0');
+        }
+    }
+    if (digits == 0) {
+        return false;
+    }
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        ++p;
+        bool negativeExponent = p < end && *p == '-';
+        if (p < end && (*p == '-' || *p == '+')) {
+            ++p;
+        }
+        int e = 0;
+        int exponentDigits = 0;
+        for (; p < end && *p >= '0' && *p <= '9'; ++p, ++exponentDigits) {
+            e = std::min(e * 10 + (*p - '0'), 1000);
+        }
+        if (exponentDigits == 0) {
+            return false;
+        }
+        exponent += negativeExponent ? -e : e;
+    }
+
+    value = (negative ? -mantissa : mantissa) * std::pow(10.0, exponent);
+    return true;
+}
+
+// * OBJ: "v x y z" и "f a b c ..." (индексы с 1, отрицательные - от конца, "a/t/n" -> a);
+// * остальные строки (нормали, текстуры, группы, материалы) пропускаются
+static bool parseObj(const char* data, const char* end, Mesh& mesh) {
+    const uint32_t base = mesh.vertexCount();
+    std::vector<uint32_t> polygon;
+
+    for (const char* p = data; p < end;) {
+        const char* lineEnd = static_cast<const char*>(std::memchr(p, '\n', end - p));
+        if (!lineEnd) {
+            lineEnd = end;
+        }
+        while (p < lineEnd && (*p == ' ' || *p == '\t')) {
+            ++p;
+        }
+
+        if (lineEnd - p > 2 && p[0] == 'v' && (p[1] == ' ' || p[1] == '\t')) {
+            ++p;
+            double vx, vy, vz;
+            if (!parseNumber(p, lineEnd, vx) || !parseNumber(p, lineEnd, vy) || !parseNumber(p, lineEnd, vz)) {
+                return false;
+            }
+            mesh.addVertex(float(vx), float(vy), float(vz));
+        } else if (lineEnd - p > 2 && p[0] == 'f' && (p[1] == ' ' || p[1] == '\t')) {
+            ++p;
+            polygon.clear();
+            double index;
+            while (parseNumber(p, lineEnd, index)) {
+                double resolved = index < 0 ? mesh.vertexCount() + index : base + index - 1;
+                if (index == 0 || resolved < base || resolved >= double(std::numeric_limits<uint32_t>::max())) {
+                    return false;
+                }
+                polygon.push_back(uint32_t(resolved));
+                while (p < lineEnd && *p != ' ' && *p != '\t' && *p != '\r') {
+                    ++p; // * "/t/n"
+                }
+            }
+            if (polygon.size() < 3) {
+                return false;
+            }
+            mesh.addPolygon(polygon.data(), polygon.size());
+        }
+        p = lineEnd + 1;
+    }
+
+    // * ссылки вперед в OBJ не допускаются, но проверяем уже после разбора всего файла
+    for (uint32_t index : mesh.indices) {
+        if (index >= mesh.vertexCount()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// * PLY: ascii и binary (little/big endian); берутся x/y/z вершин и списки vertex_indices граней,
+// * прочие элементы и свойства пропускаются
+static bool parsePly(const char* data, const char* end, Mesh& mesh) {
+    enum Type { Int8, UInt8, Int16, UInt16, Int32, UInt32, Float32, Float64, Unknown };
+    static const int typeSizes[] = {1, 1, 2, 2, 4, 4, 4, 8};
+    auto parseType = [](const std::string& name) {
+        static const char* names[][2] = {
+            {"char", "int8"}, {"uchar", "uint8"}, {"short", "int16"}, {"ushort", "uint16"},
+            {"int", "int32"}, {"uint", "uint32"}, {"float", "float32"}, {"double", "float64"},
+        };
+        for (int type = Int8; type < Unknown; ++type) {
+            if (name == names[type][0] || name == names[type][1]) {
+                return Type(type);
+            }
+        }
+        return Unknown;
+    };
+
+    struct Property {
+        std::string name;
+        Type type;
+        Type countType; // * Unknown, если свойство не список
+    };
+    struct Element {
+        std::string name;
+        long long count;
+        std::vector<Property> properties;
+    };
+    std::vector<Element> elements;
+    enum Format { Ascii, BinaryLittleEndian, BinaryBigEndian } format = Ascii;
+
+    // * заголовок
+    const char* p = data;
+    bool headerDone = false;
+    while (p < end && !headerDone) {
+        const char* lineEnd = static_cast<const char*>(std::memchr(p, '\n', end - p));
+        if (!lineEnd) {
+            return false;
+        }
+        std::istringstream line(std::string(p, lineEnd));
+        p = lineEnd + 1;
+
+        std::string keyword;
+        line >> keyword;
+        if (keyword == "format") {
+            std::string name;
+            line >> name;
+            if (name == "ascii") {
+                format = Ascii;
+            } else if (name == "binary_little_endian") {
+                format = BinaryLittleEndian;
+            } else if (name == "binary_big_endian") {
+                format = BinaryBigEndian;
+            } else {
+                return false;
+            }
+        } else if (keyword == "element") {
+            Element element;
+            if (!(line >> element.name >> element.count) || element.count < 0) {
+                return false;
+            }
+            elements.push_back(element);
+        } else if (keyword == "property") {
+            if (elements.empty()) {
+                return false;
+            }
+            std::string type;
+            Property property;
+            line >> type;
+            if (type == "list") {
+                std::string countType, itemType;
+                line >> countType >> itemType >> property.name;
+                property.countType = parseType(countType);
+                property.type = parseType(itemType);
+                if (property.countType == Unknown) {
+                    return false;
+                }
+            } else {
+                line >> property.name;
+                property.type = parseType(type);
+                property.countType = Unknown;
+            }
+            if (property.type == Unknown) {
+                return false;
+            }
+            elements.back().properties.push_back(property);
+        } else if (keyword == "end_header") {
+            headerDone = true;
+        }
+    }
+    if (!headerDone) {
+        return false;
+    }
+
+    // * одно значение любого типа; двоичные данные читаются через memcpy (выравнивания нет),
+    // * порядок байт машины считаем little endian (x86, arm64)
+    auto readValue = [&](Type type, double& value) -> bool {
+        if (format == Ascii) {
+            return parseNumber(p, end, value);
+        }
+        int size = typeSizes[type];
+        if (end - p < size) {
+            return false;
+        }
+        unsigned char bytes[8];
+        std::memcpy(bytes, p, size);
+        p += size;
+        if (format == BinaryBigEndian) {
+            std::reverse(bytes, bytes + size);
+        }
+        switch (type) {
+        case Int8: { int8_t v; std::memcpy(&v, bytes, 1); value = v; break; }
+        case UInt8: { uint8_t v; std::memcpy(&v, bytes, 1); value = v; break; }
+        case Int16: { int16_t v; std::memcpy(&v, bytes, 2); value = v; break; }
+        case UInt16: { uint16_t v; std::memcpy(&v, bytes, 2); value = v; break; }
+        case Int32: { int32_t v; std::memcpy(&v, bytes, 4); value = v; break; }
+        case UInt32: { uint32_t v; std::memcpy(&v, bytes, 4); value = v; break; }
+        case Float32: { float v; std::memcpy(&v, bytes, 4); value = v; break; }
+        default: { double v; std::memcpy(&v, bytes, 8); value = v; break; }
+        }
+        return true;
+    };
+
+    const uint32_t base = mesh.vertexCount();
+    uint32_t fileVertices = 0;
+    std::vector<uint32_t> polygon;
+
+    for (const Element& element : elements) {
+        bool isVertex = element.name == "vertex";
+        bool isFace = element.name == "face";
+        // * резерв не больше, чем могло бы поместиться в остаток файла
+        long long reserve = std::min<long long>(element.count, end - p);
+        if (isVertex) {
+            fileVertices = uint32_t(element.count);
+            mesh.x.reserve(mesh.x.size() + reserve);
+            mesh.y.reserve(mesh.y.size() + reserve);
+            mesh.z.reserve(mesh.z.size() + reserve);
+        } else if (isFace) {
+            mesh.indices.reserve(mesh.indices.size() + reserve * 3);
+        }
+
+        for (long long row = 0; row < element.count; ++row) {
+            double position[3] = {0, 0, 0};
+            for (const Property& property : element.properties) {
+                double value;
+                if (property.countType == Unknown) {
+                    if (!readValue(property.type, value)) {
+                        return false;
+                    }
+                    if (isVertex && property.name.size() == 1 && property.name[0] >= 'x' && property.name[0] <= 'z') {
+                        position[property.name[0] - 'x'] = value;
+                    }
+                    continue;
+                }
+
+                double count;
+                if (!readValue(property.countType, count) || count < 0) {
+                    return false;
+                }
+                bool isIndexList = isFace && (property.name == "vertex_indices" || property.name == "vertex_index");
+                polygon.clear();
+                for (long long i = 0; i < (long long)count; ++i) {
+                    if (!readValue(property.type, value)) {
+                        return false;
+                    }
+                    if (isIndexList) {
+                        if (value < 0 || value >= fileVertices) {
+                            return false;
+                        }
+                        polygon.push_back(base + uint32_t(value));
+                    }
+                }
+                if (isIndexList) {
+                    mesh.addPolygon(polygon.data(), polygon.size());
+                }
+            }
+            if (isVertex) {
+                mesh.addVertex(float(position[0]), float(position[1]), float(position[2]));
+            }
+        }
+    }
+    return true;
+}
+
+// * формат определяется по содержимому: PLY начинается с "ply", остальное считаем OBJ
+static bool loadMesh(const QString& path, Mesh& mesh) {
+    QFile file(path);
+    if (!file.open(QFile::ReadOnly)) {
+        qWarning() << "can't open mesh" << path;
+        return false;
+    }
+    QByteArray data = file.readAll();
+    const char* begin = data.constData();
+    const char* end = begin + data.size();
+
+    bool ok = data.startsWith("ply") ? parsePly(begin, end, mesh) : parseObj(begin, end, mesh);
+    if (!ok || mesh.triangleCount() == 0) {
+        qWarning() << "can't parse mesh" << path;
+        return false;
+    }
+    return true;
+}
+
+// * квадрика Гарланда-Хекберта: сумма квадратов расстояний до набора плоскостей.
+// * Симметричная матрица 4x4 хранится верхним треугольником по строкам
+struct Quadric {
+    double q[10] = {};
+
+    void addPlane(double a, double b, double c, double d, double weight) {
+        const double p[4] = {a, b, c, d};
+        for (int i = 0, k = 0; i < 4; ++i) {
+            for (int j = i; j < 4; ++j, ++k) {
+                q[k] += weight * p[i] * p[j];
+            }
+        }
+    }
+
+    Quadric& operator+=(const Quadric& other) {
+        for (int k = 0; k < 10; ++k) {
+            q[k] += other.q[k];
+        }
+        return *this;
+    }
+
+    double error(double x, double y, double z) const {
+        return q[0] * x * x + 2 * q[1] * x * y + 2 * q[2] * x * z + 2 * q[3] * x
+             + q[4] * y * y + 2 * q[5] * y * z + 2 * q[6] * y
+             + q[7] * z * z + 2 * q[8] * z
+             + q[9];
+    }
+};
+
+// * упрощенные уровни сетки стягиванием ребер по квадрикам. Ребро (u, v) стягивается в одну из своих
+// * вершин, новых вершин нет - все уровни дописываются в indices поверх тех же массивов. Каждый
+// * следующий уровень примерно вчетверо меньше предыдущего, самый грубый - не меньше minTriangles
+static void buildLevels(Mesh& mesh, uint32_t minTriangles = 64, size_t maxLevels = 6) {
+    const uint32_t baseCount = mesh.baseTriangleCount();
+    mesh.indices.resize(size_t(baseCount) * 3);
+    mesh.levels = {{0, baseCount, 0.0f}};
+    if (baseCount / 4 < minTriangles) {
+        return;
+    }
+
+    const uint32_t vertexCount = mesh.vertexCount();
+    std::vector<uint32_t> triangles(mesh.indices);
+    std::vector<uint8_t> alive(baseCount, 1);
+    uint32_t aliveCount = baseCount;
+
+    // * ненормированная нормаль треугольника abc, у которого вершина from заменена на to
+    auto normal = [&](const uint32_t* tri, uint32_t from, uint32_t to, double (&n)[3]) {
+        uint32_t a = tri[0] == from ? to : tri[0];
+        uint32_t b = tri[1] == from ? to : tri[1];
+        uint32_t c = tri[2] == from ? to : tri[2];
+        double ux = mesh.x[b] - mesh.x[a], uy = mesh.y[b] - mesh.y[a], uz = mesh.z[b] - mesh.z[a];
+        double vx = mesh.x[c] - mesh.x[a], vy = mesh.y[c] - mesh.y[a], vz = mesh.z[c] - mesh.z[a];
+        n[0] = uy * vz - uz * vy;
+        n[1] = uz * vx - ux * vz;
+        n[2] = ux * vy - uy * vx;
+    };
+
+    // * квадрика вершины - плоскости треугольников вокруг нее, треугольники вокруг вершины - для стягивания
+    std::vector<Quadric> quadrics(vertexCount);
+    std::vector<std::vector<uint32_t>> vertexTriangles(vertexCount);
+    for (uint32_t t = 0; t < baseCount; ++t) {
+        const uint32_t* tri = &triangles[size_t(t) * 3];
+        double n[3];
+        normal(tri, tri[0], tri[0], n);
+        double length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+        for (int k = 0; k < 3; ++k) {
+            uint32_t a = tri[k];
+            if (length > 0) {
+                quadrics[a].addPlane(n[0] / length, n[1] / length, n[2] / length,
+                                     -(n[0] * mesh.x[a] + n[1] * mesh.y[a] + n[2] * mesh.z[a]) / length, 1.0);
+            }
+            vertexTriangles[a].push_back(t);
+        }
+    }
+
+    // * ребро края есть только у одного треугольника; чтобы край не съеживался, к его концам добавляется
+    // * плоскость через ребро перпендикулярно грани (с большим весом)
+    std::vector<uint8_t> boundary(baseCount, 0); // * бит k - ребро (tri[k], tri[k + 1]) на краю
+    for (uint32_t t = 0; t < baseCount; ++t) {
+        const uint32_t* tri = &triangles[size_t(t) * 3];
+        for (int k = 0; k < 3; ++k) {
+            uint32_t a = tri[k], b = tri[(k + 1) % 3];
+            bool shared = false;
+            for (uint32_t other : vertexTriangles[a]) {
+                const uint32_t* o = &triangles[size_t(other) * 3];
+                shared = shared || (other != t && (o[0] == b || o[1] == b || o[2] == b));
+            }
+            if (shared) {
+                continue;
+            }
+            boundary[t] |= uint8_t(1 << k);
+
+            double n[3];
+            normal(tri, tri[0], tri[0], n);
+            double ex = mesh.x[b] - mesh.x[a], ey = mesh.y[b] - mesh.y[a], ez = mesh.z[b] - mesh.z[a];
+            double px = ey * n[2] - ez * n[1], py = ez * n[0] - ex * n[2], pz = ex * n[1] - ey * n[0];
+            double length = std::sqrt(px * px + py * py + pz * pz);
+            if (length > 0) {
+                px /= length;
+                py /= length;
+                pz /= length;
+                double d = -(px * mesh.x[a] + py * mesh.y[a] + pz * mesh.z[a]);
+                quadrics[a].addPlane(px, py, pz, d, 100.0);
+                quadrics[b].addPlane(px, py, pz, d, 100.0);
+            }
+        }
+    }
+
+    // * стягивание не должно переворачивать оставшиеся вокруг from треугольники
+    auto canCollapse = [&](uint32_t from, uint32_t to) {
+        for (uint32_t t : vertexTriangles[from]) {
+            const uint32_t* tri = &triangles[size_t(t) * 3];
+            if (!alive[t] || tri[0] == to || tri[1] == to || tri[2] == to) {
+                continue;
+            }
+            double before[3], after[3];
+            normal(tri, from, from, before);
+            normal(tri, from, to, after);
+            if (before[0] * after[0] + before[1] * after[1] + before[2] * after[2] <= 0) {
+                return false;
+            }
+        }
+        return true;
+    };
+
+    // * треугольники с обеими вершинами вырождаются, остальные переходят к to
+    auto collapse = [&](uint32_t from, uint32_t to) {
+        for (uint32_t t : vertexTriangles[from]) {
+            uint32_t* tri = &triangles[size_t(t) * 3];
+            if (!alive[t]) {
+                continue;
+            }
+            if (tri[0] == to || tri[1] == to || tri[2] == to) {
+                alive[t] = 0;
+                --aliveCount;
+                continue;
+            }
+            for (int k = 0; k < 3; ++k) {
+                tri[k] = tri[k] == from ? to : tri[k];
+            }
+            vertexTriangles[to].push_back(t);
+        }
+        std::vector<uint32_t>().swap(vertexTriangles[from]);
+        quadrics[to] += quadrics[from];
+
+        std::vector<uint32_t>& around = vertexTriangles[to];
+        around.erase(std::remove_if(around.begin(), around.end(), [&](uint32_t t) { return !alive[t]; }), around.end());
+    };
+
+    double maxCost = 0;
+    auto saveLevel = [&]() {
+        Mesh::Level level{mesh.triangleCount(), aliveCount, float(std::sqrt(maxCost))};
+        for (uint32_t t = 0; t < baseCount; ++t) {
+            if (alive[t]) {
+                mesh.indices.insert(mesh.indices.end(), &triangles[size_t(t) * 3], &triangles[size_t(t) * 3] + 3);
+            }
+        }
+        mesh.levels.push_back(level);
+    };
+
+    // * стягивания идут проходами вместо очереди с приоритетами: ребра сортируются по цене, и стягиваются
+    // * самые дешевые, не длиннее нужного до следующего уровня и только с вершинами, которые этот проход
+    // * еще не трогал (у задетых поменялась квадрика). Цены пересчитываются в следующем проходе
+    struct Collapse {
+        double cost;
+        uint32_t from, to;
+    };
+    std::vector<Collapse> collapses;
+    std::vector<uint8_t> locked(vertexCount);
+    uint32_t target = baseCount / 4;
+    while (mesh.levels.size() < maxLevels) {
+        // * внутреннее ребро есть у двух треугольников в разных направлениях - берем его из того,
+        // * где a < b; ребро края - всегда. Из двух направлений стягивания выбирается более дешевое
+        collapses.clear();
+        for (uint32_t t = 0; t < baseCount; ++t) {
+            const uint32_t* tri = &triangles[size_t(t) * 3];
+            for (int k = 0; alive[t] && k < 3; ++k) {
+                uint32_t a = tri[k], b = tri[(k + 1) % 3];
+                if (a > b && !(boundary[t] & (1 << k))) {
+                    continue;
+                }
+                Quadric q = quadrics[a];
+                q += quadrics[b];
+                double toB = q.error(mesh.x[b], mesh.y[b], mesh.z[b]);
+                double toA = q.error(mesh.x[a], mesh.y[a], mesh.z[a]);
+                collapses.push_back(toB <= toA ? Collapse{toB, a, b} : Collapse{toA, b, a});
+            }
+        }
+        if (collapses.empty()) {
+            break;
+        }
+
+        // * стягивание убирает ~2 треугольника -> до уровня нужно ~(alive - target) / 2 самых дешевых ребер.
+        // * Нижняя граница - чтобы под конец, когда почти все дешевые переворачивают грани,
+        // * проходы не вырождались в одно стягивание
+        auto cheaper = [](const Collapse& a, const Collapse& b) { return a.cost < b.cost; };
+        size_t count = std::min(collapses.size(), std::max<size_t>((aliveCount - target) / 2, collapses.size() / 16));
+        std::nth_element(collapses.begin(), collapses.begin() + (count - 1), collapses.end(), cheaper);
+        std::sort(collapses.begin(), collapses.begin() + count, cheaper);
+
+        std::fill(locked.begin(), locked.end(), 0);
+        uint32_t aliveBefore = aliveCount;
+        for (size_t i = 0; i < count && aliveCount > target; ++i) {
+            const Collapse& c = collapses[i];
+            if (locked[c.from] || locked[c.to] || !canCollapse(c.from, c.to)) {
+                continue;
+            }
+            collapse(c.from, c.to);
+            locked[c.from] = locked[c.to] = 1;
+            maxCost = std::max(maxCost, c.cost);
+        }
+        if (aliveCount == aliveBefore) {
+            break; // * дальше стягивать нечего (все оставшиеся переворачивают грани)
+        }
+
+        if (aliveCount <= target) {
+            saveLevel();
+            target = aliveCount / 4;
+            if (target < minTriangles) {
+                break;
+            }
+        }
+    }
+}
+
+// * процедурный тор примерно из triangles треугольников (для замеров): сетка sides x 2 * sides четырехугольников
+static Mesh makeTorus(uint32_t triangles) {
+    const uint32_t sides = std::max(3u, uint32_t(std::lround(std::sqrt(triangles / 4.0))));
+    const uint32_t rings = 2 * sides;
+    const double pi = std::acos(-1.0);
+
+    Mesh torus;
+    for (uint32_t i = 0; i < rings; ++i) {
+        double u = 2 * pi * i / rings;
+        for (uint32_t j = 0; j < sides; ++j) {
+            double v = 2 * pi * j / sides;
+            double r = 1.0 + 0.4 * std::cos(v);
+            torus.addVertex(float(r * std::cos(u)), float(0.4 * std::sin(v)), float(r * std::sin(u)));
+        }
+    }
+    for (uint32_t i = 0; i < rings; ++i) {
+        for (uint32_t j = 0; j < sides; ++j) {
+            const uint32_t quad[4] = {
+                i * sides + j,
+                i * sides + (j + 1) % sides,
+                (i + 1) % rings * sides + (j + 1) % sides,
+                (i + 1) % rings * sides + j,
+            };
+            torus.addPolygon(quad, 4);
+        }
+    }
+    return torus;
+}
+
+// * вершина после проекции: экранные координаты + глубина (1/w, больше = ближе)
+struct ScreenVertex {
+    float x, y;
+    float depth;
+    float shadowX, shadowY, shadowW; // * однородные координаты в карте теней (нужны только для теней)
+
+    // * атрибуты для гладкой закраски: цвет r, g, b (Гуро) или нормаль и мировая позиция (Фонг)
+    static const int MaxVaryings = 6;
+    float varyings[MaxVaryings];
+};
+
+// * одна полоса: хвосты массивов и машины без SIMD
+struct ScalarFloat {
+    static const int Width = 1;
+    float v;
+
+    static ScalarFloat load(const float* p) { return {*p}; }
+    static ScalarFloat broadcast(float f) { return {f}; }
+    void store(float* p) const { *p = v; }
+    friend ScalarFloat operator+(ScalarFloat a, ScalarFloat b) { return {a.v + b.v}; }
+    friend ScalarFloat operator-(ScalarFloat a, ScalarFloat b) { return {a.v - b.v}; }
+    friend ScalarFloat operator*(ScalarFloat a, ScalarFloat b) { return {a.v * b.v}; }
+    friend ScalarFloat operator/(ScalarFloat a, ScalarFloat b) { return {a.v / b.v}; }
+    static ScalarFloat mulAdd(ScalarFloat a, ScalarFloat b, ScalarFloat c) { return {a.v * b.v + c.v}; }
+    static ScalarFloat max(ScalarFloat a, ScalarFloat b) { return {std::max(a.v, b.v)}; }
+    static ScalarFloat min(ScalarFloat a, ScalarFloat b) { return {std::min(a.v, b.v)}; }
+    static ScalarFloat sqrt(ScalarFloat a) { return {std::sqrt(a.v)}; }
+    // * каналы уже в [0, 255] -> 0xffRRGGBB с отбрасыванием дробной части
+    static void storeRgb(ScalarFloat r, ScalarFloat g, ScalarFloat b, uint32_t* out) {
+        *out = 0xff000000u | uint32_t(r.v) << 16 | uint32_t(g.v) << 8 | uint32_t(b.v);
+    }
+};
+
+// * SIMD-регистр из float: 4 полосы на SSE/NEON, иначе 1. AVX2 - только в ядре преобразования вершин,
+// * с выбором при запуске. Нужны только операции, которые используют стадии конвейера
+#if defined(__SSE2__) || defined(_M_X64)
+struct SimdFloat {
+    static const int Width = 4;
+    __m128 v;
+
+    static SimdFloat load(const float* p) { return {_mm_loadu_ps(p)}; }
+    static SimdFloat broadcast(float f) { return {_mm_set1_ps(f)}; }
+    void store(float* p) const { _mm_storeu_ps(p, v); }
+    friend SimdFloat operator+(SimdFloat a, SimdFloat b) { return {_mm_add_ps(a.v, b.v)}; }
+    friend SimdFloat operator-(SimdFloat a, SimdFloat b) { return {_mm_sub_ps(a.v, b.v)}; }
+    friend SimdFloat operator*(SimdFloat a, SimdFloat b) { return {_mm_mul_ps(a.v, b.v)}; }
+    friend SimdFloat operator/(SimdFloat a, SimdFloat b) { return {_mm_div_ps(a.v, b.v)}; }
+    static SimdFloat mulAdd(SimdFloat a, SimdFloat b, SimdFloat c) { return a * b + c; }
+    static SimdFloat max(SimdFloat a, SimdFloat b) { return {_mm_max_ps(a.v, b.v)}; }
+    static SimdFloat min(SimdFloat a, SimdFloat b) { return {_mm_min_ps(a.v, b.v)}; }
+    static SimdFloat sqrt(SimdFloat a) { return {_mm_sqrt_ps(a.v)}; }
+    static void storeRgb(SimdFloat r, SimdFloat g, SimdFloat b, uint32_t* out) {
+        __m128i rgb = _mm_or_si128(_mm_slli_epi32(_mm_cvttps_epi32(r.v), 16),
+                                   _mm_or_si128(_mm_slli_epi32(_mm_cvttps_epi32(g.v), 8), _mm_cvttps_epi32(b.v)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_or_si128(rgb, _mm_set1_epi32(int(0xff000000u))));
+    }
+};
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+struct SimdFloat {
+    static const int Width = 4;
+    float32x4_t v;
+
+    static SimdFloat load(const float* p) { return {vld1q_f32(p)}; }
+    static SimdFloat broadcast(float f) { return {vdupq_n_f32(f)}; }
+    void store(float* p) const { vst1q_f32(p, v); }
+    friend SimdFloat operator+(SimdFloat a, SimdFloat b) { return {vaddq_f32(a.v, b.v)}; }
+    friend SimdFloat operator-(SimdFloat a, SimdFloat b) { return {vsubq_f32(a.v, b.v)}; }
+    friend SimdFloat operator*(SimdFloat a, SimdFloat b) { return {vmulq_f32(a.v, b.v)}; }
+    friend SimdFloat operator/(SimdFloat a, SimdFloat b) { return {vdivq_f32(a.v, b.v)}; }
+    static SimdFloat mulAdd(SimdFloat a, SimdFloat b, SimdFloat c) { return {vfmaq_f32(c.v, a.v, b.v)}; }
+    static SimdFloat max(SimdFloat a, SimdFloat b) { return {vmaxq_f32(a.v, b.v)}; }
+    static SimdFloat min(SimdFloat a, SimdFloat b) { return {vminq_f32(a.v, b.v)}; }
+    static SimdFloat sqrt(SimdFloat a) { return {vsqrtq_f32(a.v)}; }
+    static void storeRgb(SimdFloat r, SimdFloat g, SimdFloat b, uint32_t* out) {
+        uint32x4_t rgb = vorrq_u32(vshlq_n_u32(vcvtq_u32_f32(r.v), 16),
+                                   vorrq_u32(vshlq_n_u32(vcvtq_u32_f32(g.v), 8), vcvtq_u32_f32(b.v)));
+        vst1q_u32(out, vorrq_u32(rgb, vdupq_n_u32(0xff000000u)));
+    }
+};
+#else
+using SimdFloat = ScalarFloat;
+#endif
+
+// * матрица 4x4 по строкам: clip = m * (x, y, z, 1)
+struct Matrix4 {
+    float m[4][4];
+
+    static Matrix4 rows(const float (&r)[4][4]) {
+        Matrix4 result;
+        std::memcpy(result.m, r, sizeof(result.m));
+        return result;
+    }
+};
+
+// * стадия обработки вершин: SoA-массивы x/y/z умножаются на матрицу по SimdFloat::Width вершин за раз.
+// * С делением на w (строка 3) пишет (r0 . p, r1 . p, r2 . p) / w - экранные x, y и глубину;
+// * без деления - однородные r0 . p, r1 . p, r2 . p (для перспективно-корректной интерполяции)
+template<bool PerspectiveDivide, class Lanes>
+static size_t transformLanes(const Matrix4& matrix, const float* x, const float* y, const float* z, size_t begin, size_t end,
+                             float* out0, float* out1, float* out2) {
+    Lanes r[4][4];
+    for (int row = 0; row < 4; ++row) {
+        for (int column = 0; column < 4; ++column) {
+            r[row][column] = Lanes::broadcast(matrix.m[row][column]);
+        }
+    }
+
+    size_t i = begin;
+    for (; i + Lanes::Width <= end; i += Lanes::Width) {
+        Lanes px = Lanes::load(x + i);
+        Lanes py = Lanes::load(y + i);
+        Lanes pz = Lanes::load(z + i);
+        auto row = [&](int k) {
+            return Lanes::mulAdd(r[k][0], px, Lanes::mulAdd(r[k][1], py, Lanes::mulAdd(r[k][2], pz, r[k][3])));
+        };
+
+        Lanes c0 = row(0);
+        Lanes c1 = row(1);
+        Lanes c2 = row(2);
+        if (PerspectiveDivide) {
+            Lanes invW = Lanes::broadcast(1.0f) / row(3);
+            c0 = c0 * invW;
+            c1 = c1 * invW;
+            c2 = c2 * invW;
+        }
+        c0.store(out0 + i);
+        c1.store(out1 + i);
+        c2.store(out2 + i);
+    }
+    return i;
+}
+
+// * то же ядро на AVX2 + FMA, по 8 вершин. Собирается с этими инструкциями только эта функция,
+// * остальной код остается на базовом x86-64; вызывается, только если процессор их поддерживает
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_AVX2_TRANSFORM 1
+
+// * r . (x, y, z, 1); лямбда не унаследовала бы target, поэтому отдельная функция
+__attribute__((target("avx2,fma")))
+static inline __m256 transformRowAvx2(const __m256 (&r)[4], __m256 x, __m256 y, __m256 z) {
+    return _mm256_fmadd_ps(r[0], x, _mm256_fmadd_ps(r[1], y, _mm256_fmadd_ps(r[2], z, r[3])));
+}
+
+template<bool PerspectiveDivide>
+__attribute__((target("avx2,fma")))
+static size_t transformLanesAvx2(const Matrix4& matrix, const float* x, const float* y, const float* z, size_t begin, size_t end,
+                                 float* out0, float* out1, float* out2) {
+    __m256 r[4][4];
+    for (int row = 0; row < 4; ++row) {
+        for (int column = 0; column < 4; ++column) {
+            r[row][column] = _mm256_set1_ps(matrix.m[row][column]);
+        }
+    }
+
+    size_t i = begin;
+    for (; i + 8 <= end; i += 8) {
+        __m256 px = _mm256_loadu_ps(x + i);
+        __m256 py = _mm256_loadu_ps(y + i);
+        __m256 pz = _mm256_loadu_ps(z + i);
+
+        __m256 c0 = transformRowAvx2(r[0], px, py, pz);
+        __m256 c1 = transformRowAvx2(r[1], px, py, pz);
+        __m256 c2 = transformRowAvx2(r[2], px, py, pz);
+        if (PerspectiveDivide) {
+            __m256 invW = _mm256_div_ps(_mm256_set1_ps(1.0f), transformRowAvx2(r[3], px, py, pz));
+            c0 = _mm256_mul_ps(c0, invW);
+            c1 = _mm256_mul_ps(c1, invW);
+            c2 = _mm256_mul_ps(c2, invW);
+        }
+        _mm256_storeu_ps(out0 + i, c0);
+        _mm256_storeu_ps(out1 + i, c1);
+        _mm256_storeu_ps(out2 + i, c2);
+    }
+    return i;
+}
+
+static bool cpuHasAvx2() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+}
+#endif
+
+template<bool PerspectiveDivide>
+static void transformVertices(const Matrix4& matrix, const float* x, const float* y, const float* z, size_t begin, size_t end,
+                              float* out0, float* out1, float* out2) {
+    using Kernel = size_t (*)(const Matrix4&, const float*, const float*, const float*, size_t, size_t, float*, float*, float*);
+#if defined(HAVE_AVX2_TRANSFORM)
+    // * ядро выбирается один раз, при первом вызове
+    static const Kernel kernel = cpuHasAvx2() ? transformLanesAvx2<PerspectiveDivide> : transformLanes<PerspectiveDivide, SimdFloat>;
+#else
+    static const Kernel kernel = transformLanes<PerspectiveDivide, SimdFloat>;
+#endif
+    size_t done = kernel(matrix, x, y, z, begin, end, out0, out1, out2);
+    transformLanes<PerspectiveDivide, ScalarFloat>(matrix, x, y, z, done, end, out0, out1, out2);
+}
+
+// * кэш вершин после преобразования (SoA, как выход стадии): экранные x, y, глубина
+// * и, если нужны тени, однородные координаты в карте теней
+struct VertexCache {
+    std::vector<float> x, y, depth;
+    std::vector<float> shadowX, shadowY, shadowW;
+
+    void resize(size_t count, bool withShadow) {
+        x.resize(count);
+        y.resize(count);
+        depth.resize(count);
+        shadowX.resize(withShadow ? count : 0);
+        shadowY.resize(withShadow ? count : 0);
+        shadowW.resize(withShadow ? count : 0);
+    }
+
+    ScreenVertex at(uint32_t i) const {
+        if (shadowW.empty()) {
+            return {x[i], y[i], depth[i], 0, 0, 0, {}};
+        }
+        return {x[i], y[i], depth[i], shadowX[i], shadowY[i], shadowW[i], {}};
+    }
+};
+
+// * карта теней: глубина 1/w из источника света, size x size текселей
+struct ShadowMap {
+    static const int TileSize = 4; // * min/max глубины по тайлам 4x4 текселя
+
+    int size = 0;
+    const float* depth = nullptr;
+    float bias = 0.05f; // * в единицах w источника, против "acne"
+
+    int tiles = 0;
+    std::vector<float> tileMin;
+    std::vector<float> tileMax;
+
+    enum Coverage { Shadowed, Lit, Partial };
+
+    // * пересчет min/max по тайлам, после каждого обновления depth
+    void buildTiles() {
+        tiles = (size + TileSize - 1) / TileSize;
+        tileMin.assign(size_t(tiles) * tiles, std::numeric_limits<float>::max());
+        tileMax.assign(size_t(tiles) * tiles, 0.0f);
+        for (int y = 0; y < size; ++y) {
+            for (int x = 0; x < size; ++x) {
+                size_t tile = size_t(y / TileSize) * tiles + x / TileSize;
+                float value = depth[size_t(y) * size + x];
+                tileMin[tile] = std::min(tileMin[tile], value);
+                tileMax[tile] = std::max(tileMax[tile], value);
+            }
+        }
+    }
+
+    // * консервативная проверка прямоугольника [u0, u1] x [v0, v1] для точек с расстоянием [w0, w1]:
+    // * Lit/Shadowed, если PCF гарантированно даст 1/0, иначе Partial
+    Coverage classify(float u0, float v0, float u1, float v1, float w0, float w1) const {
+        // * +1 тексель на ядро PCF 3x3
+        int x0 = int(std::floor(u0)) - 1, y0 = int(std::floor(v0)) - 1;
+        int x1 = int(std::floor(u1)) + 1, y1 = int(std::floor(v1)) + 1;
+        if (x0 < 0 || y0 < 0 || x1 >= size || y1 >= size) {
+            return Partial; // * края карты - пусть разбирается попиксельно
+        }
+        int tx0 = x0 / TileSize, ty0 = y0 / TileSize, tx1 = x1 / TileSize, ty1 = y1 / TileSize;
+        if ((tx1 - tx0 + 1) * (ty1 - ty0 + 1) > 256) {
+            return Partial; // * слишком большой след, проверка дороже самого PCF
+        }
+
+        float minDepth = std::numeric_limits<float>::max();
+        float maxDepth = 0.0f;
+        for (int ty = ty0; ty <= ty1; ++ty) {
+            for (int tx = tx0; tx <= tx1; ++tx) {
+                minDepth = std::min(minDepth, tileMin[size_t(ty) * tiles + tx]);
+                maxDepth = std::max(maxDepth, tileMax[size_t(ty) * tiles + tx]);
+            }
+        }
+
+        if ((w1 - bias) * maxDepth <= 1.0f) {
+            return Lit;
+        }
+        if ((w0 - bias) * minDepth > 1.0f) {
+            return Shadowed;
+        }
+        return Partial;
+    }
+
+    // * доля освещенности 0..1 точки с координатами (u, v) в карте и расстоянием w от источника, PCF 3x3
+    float lit(float u, float v, float w) const {
+        int cu = int(std::floor(u));
+        int cv = int(std::floor(v));
+        int litCount = 0;
+        float threshold = w - bias;
+
+        if (cu >= 1 && cv >= 1 && cu < size - 1 && cv < size - 1) {
+            const float* row = depth + size_t(cv - 1) * size + cu - 1;
+            for (int y = 0; y < 3; ++y, row += size) {
+                litCount += (threshold * row[0] <= 1.0f) + (threshold * row[1] <= 1.0f) + (threshold * row[2] <= 1.0f);
+            }
+            return litCount / 9.0f;
+        }
+
+        for (int y = cv - 1; y <= cv + 1; ++y) {
+            for (int x = cu - 1; x <= cu + 1; ++x) {
+                if (x < 0 || y < 0 || x >= size || y >= size) {
+                    litCount++; // * вне карты теней никто не загораживает
+                    continue;
+                }
+                // * w - bias <= 1 / stored, без деления; stored = 0 -> пусто
+                if (threshold * depth[size_t(y) * size + x] <= 1.0f) {
+                    litCount++;
+                }
+            }
+        }
+        return litCount / 9.0f;
+    }
+};
+
+// * программный растеризатор: half-space (edge functions) + обход блоками 8x8 + float z-buffer
+// * sort-middle: drawTriangle только готовит треугольник и раскладывает его по тайлам экрана,
+// * flush() растеризует тайлы параллельно, каждый тайл пишет только в свою часть color/depth буферов
+class SoftwareRasterizer {
+public:
+    static const int BlockSize = 8;
+    static const int TileSize = 64; // * кратно BlockSize
+    static const int SubpixelBits = 4; // * фиксированная точка 28.4
+    static const int SubpixelScale = 1 << SubpixelBits;
+
+    SoftwareRasterizer() {
+        setThreadCount(QThread::idealThreadCount());
+    }
+
+    void setThreadCount(int count) {
+        threadPool.setMaxThreadCount(std::max(1, count));
+    }
+
+    int threadCount() const {
+        return threadPool.maxThreadCount();
+    }
+
+    // * без записи цвета растеризатор заполняет только z-буфер (проход для карты теней)
+    void setColorWrites(bool enabled) {
+        colorWrites = enabled;
+    }
+
+    // * карта теней для drawShadowedTriangle, должна быть жива до flush()
+    void setShadowMap(const ShadowMap* map) {
+        shadowMap = map;
+    }
+
+    // * Flat - цвет грани; Gouraud - цвет из varyings[0..2] вершин (r, g, b);
+    // * Phong - varyings = нормаль и мировая позиция, освещение от setLight() считается в каждом пикселе.
+    // * В гладких режимах color в draw* не используется, shadowColor - по-прежнему цвет в тени.
+    // * Действует на следующие draw*
+    enum Shading { FlatShading, GouraudShading, PhongShading };
+
+    void setShading(Shading mode) {
+        shading = mode;
+    }
+
+    // * точечный источник для Фонга: цвет = max(cos * diffuse, ambient) по каналам
+    void setLight(float x, float y, float z, QRgb diffuse, QRgb ambient) {
+        light[0] = x;
+        light[1] = y;
+        light[2] = z;
+        lightDiffuse[0] = float(qRed(diffuse));
+        lightDiffuse[1] = float(qGreen(diffuse));
+        lightDiffuse[2] = float(qBlue(diffuse));
+        lightAmbient[0] = float(qRed(ambient));
+        lightAmbient[1] = float(qGreen(ambient));
+        lightAmbient[2] = float(qBlue(ambient));
+    }
+
+    const float* depth() const {
+        return depthBuffer.data();
+    }
+
+    void resize(int w, int h) {
+        if (w == width && h == height) {
+            return;
+        }
+        width = w;
+        height = h;
+        tilesX = (w + TileSize - 1) / TileSize;
+        tilesY = (h + TileSize - 1) / TileSize;
+        colorBuffer = QImage(w, h, QImage::Format_RGB32);
+        depthBuffer.assign(size_t(w) * h, 0.0f);
+        blocksX = (w + BlockSize - 1) / BlockSize;
+        blockFarthest.assign(size_t(blocksX) * ((h + BlockSize - 1) / BlockSize), 0.0f);
+        blockNearest.assign(blockFarthest.size(), 0.0f);
+        tileFarthest.assign(size_t(tilesX) * tilesY, 0.0f);
+        tileFarthestStale.assign(tileFarthest.size(), 0);
+        bins.assign(size_t(tilesX) * tilesY, std::vector<uint32_t>());
+        clearPending = true;
+    }
+
+    // * сама очистка делается в flush() по тайлам, тем же потоком, что потом в тайл рисует
+    void clear(QRgb color) {
+        clearColor = color;
+        clearPending = true;
+        triangles.clear();
+        for (auto& bin : bins) {
+            bin.clear();
+        }
+    }
+
+    const QImage& image() const {
+        return colorBuffer;
+    }
+
+    // * счетчики с последнего resetStats(): треугольники, прошедшие setup, записанные пиксели
+    // * (прошедшие тест глубины) и время внутри flush()
+    struct Stats {
+        uint64_t triangles;
+        uint64_t fragments;
+        double fillSeconds;
+    };
+
+    Stats stats() const {
+        return {triangleCount, fragmentCount, fillSeconds};
+    }
+
+    void resetStats() {
+        triangleCount = 0;
+        fragmentCount = 0;
+        fillSeconds = 0;
+    }
+
+    void drawTriangle(const ScreenVertex& v0, const ScreenVertex& v1, const ScreenVertex& v2, QRgb color) {
+        submit(v0, v1, v2, color, color, false);
+    }
+
+    // * цвет в каждом пикселе смешивается между litColor и shadowColor по карте теней
+    void drawShadowedTriangle(const ScreenVertex& v0, const ScreenVertex& v1, const ScreenVertex& v2,
+                              QRgb litColor, QRgb shadowColor) {
+        submit(v0, v1, v2, litColor, shadowColor, shadowMap != nullptr);
+    }
+
+    // * закрыт ли прямоугольник [x0, x1] x [y0, y1] (в пикселях) уже нарисованным: все, что в нем
+    // * не ближе depth, не пройдет тест глубины. Смотрит только на то, что уже прошло через flush()
+    bool isOccluded(float x0, float y0, float x1, float y1, float depth) const {
+        if (clearPending) {
+            return false;
+        }
+        int bx0 = std::max(0, int(std::floor(x0))) / BlockSize;
+        int by0 = std::max(0, int(std::floor(y0))) / BlockSize;
+        int bx1 = std::min(width - 1, int(std::ceil(x1))) / BlockSize;
+        int by1 = std::min(height - 1, int(std::ceil(y1))) / BlockSize;
+        for (int by = by0; by <= by1; ++by) {
+            for (int bx = bx0; bx <= bx1; ++bx) {
+                if (depth > blockFarthest[size_t(by) * blocksX + bx]) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    // * растеризация всех накопленных треугольников; результат не зависит от числа потоков.
+    // * Можно звать несколько раз за кадр: следующие треугольники отсекаются по уже нарисованному
+    void flush() {
+        QElapsedTimer timer;
+        timer.start();
+        int tileCount = tilesX * tilesY;
+        int workers = std::min(threadCount(), tileCount);
+        std::atomic<int> nextTile(0);
+
+        // * bits() отделяет общие данные QImage (detach) - только здесь, в вызывающем потоке;
+        // * потоки тайлов пишут строки по готовому указателю и шагу
+        Target target{colorBuffer.bits(), size_t(colorBuffer.bytesPerLine())};
+
+        auto worker = [&]() {
+            for (int tile = nextTile++; tile < tileCount; tile = nextTile++) {
+                rasterizeTile(tile, target);
+            }
+        };
+
+        std::vector<QFuture<void>> futures;
+        for (int i = 1; i < workers; ++i) {
+            futures.push_back(QtConcurrent::run(&threadPool, worker));
+        }
+        worker();
+        for (auto& future : futures) {
+            future.waitForFinished();
+        }
+
+        clearPending = false;
+        triangles.clear();
+        for (auto& bin : bins) {
+            bin.clear();
+        }
+        fillSeconds += timer.nsecsElapsed() * 1e-9;
+    }
+
+private:
+    // * буфер цвета для потоков тайлов: начало и длина строки в байтах
+    struct Target {
+        uchar* bits;
+        size_t stride;
+
+        QRgb* row(int y) const {
+            return reinterpret_cast<QRgb*>(bits + size_t(y) * stride);
+        }
+    };
+
+    // * E(p) = a * p.x + b * p.y + c, со смещением по правилу top-left уже внутри c
+    struct Edge {
+        int64_t a, b, c;
+        int64_t stepX, stepY;
+
+        int64_t at(int64_t x, int64_t y) const {
+            return a * x + b * y + c;
+        }
+
+        int cornersOutside(int64_t x, int64_t y, int64_t span) const {
+            return (at(x, y) < 0) + (at(x + span, y) < 0) + (at(x, y + span) < 0) + (at(x + span, y + span) < 0);
+        }
+    };
+
+    // * величина, линейная в экранном пространстве: value = dx * x + dy * y + c (x, y - номер пикселя)
+    struct Plane {
+        float dx, dy, c;
+
+        float at(float x, float y) const {
+            return dx * x + dy * y + c;
+        }
+    };
+
+    // * треугольник после setup'а, готовый к растеризации в любом тайле
+    struct Triangle {
+        Edge e0, e1, e2;
+        Plane depth;
+        Plane shadowX, shadowY, shadowW; // * координаты карты теней, деленные на w камеры
+        Plane varyings[ScreenVertex::MaxVaryings]; // * тоже деленные на w
+        float nearestDepth; // * максимум 1/w по вершинам
+        int minX, minY, maxX, maxY;
+        QRgb color;
+        QRgb shadowColor;
+        bool shadowed;
+        Shading shading;
+    };
+
+    void submit(ScreenVertex v0, ScreenVertex v1, ScreenVertex v2, QRgb color, QRgb shadowColor, bool shadowed) {
+        // * защита от переполнения фиксированной точки: по ближней плоскости треугольники уже обрезаны,
+        // * а боковые плоскости не клиппятся, так что отбрасываем только совсем гигантские
+        const float limit = float(1 << 20);
+        for (const ScreenVertex* v : {&v0, &v1, &v2}) {
+            if (!(std::abs(v->x) < limit && std::abs(v->y) < limit)) {
+                return;
+            }
+        }
+
+        int64_t x0 = std::lround(v0.x * SubpixelScale), y0 = std::lround(v0.y * SubpixelScale);
+        int64_t x1 = std::lround(v1.x * SubpixelScale), y1 = std::lround(v1.y * SubpixelScale);
+        int64_t x2 = std::lround(v2.x * SubpixelScale), y2 = std::lround(v2.y * SubpixelScale);
+
+        int64_t area = (x1 - x0) * (y2 - y0) - (y1 - y0) * (x2 - x0);
+        if (area == 0) {
+            return;
+        }
+        if (area < 0) { // * приводим к одному обходу, чтобы внутренность была там, где все E >= 0
+            std::swap(x1, x2);
+            std::swap(y1, y2);
+            std::swap(v1, v2);
+            area = -area;
+        }
+
+        Triangle tri;
+        tri.minX = std::max(0, int((std::min({x0, x1, x2}) >> SubpixelBits)));
+        tri.minY = std::max(0, int((std::min({y0, y1, y2}) >> SubpixelBits)));
+        tri.maxX = std::min(width - 1, int((std::max({x0, x1, x2}) + SubpixelScale - 1) >> SubpixelBits));
+        tri.maxY = std::min(height - 1, int((std::max({y0, y1, y2}) + SubpixelScale - 1) >> SubpixelBits));
+        if (tri.minX > tri.maxX || tri.minY > tri.maxY) {
+            return;
+        }
+
+        tri.e0 = makeEdge(x1, y1, x2, y2); // * напротив v0
+        tri.e1 = makeEdge(x2, y2, x0, y0); // * напротив v1
+        tri.e2 = makeEdge(x0, y0, x1, y1); // * напротив v2
+
+        // * глубина 1/w линейна в экранном пространстве
+        float invArea = 1.0f / float(area);
+        auto makePlane = [&](float a0, float a1, float a2) {
+            Plane plane;
+            plane.dx = (tri.e1.a * (a1 - a0) + tri.e2.a * (a2 - a0)) * SubpixelScale * invArea;
+            plane.dy = (tri.e1.b * (a1 - a0) + tri.e2.b * (a2 - a0)) * SubpixelScale * invArea;
+            plane.c = a0 - plane.dx * (x0 / float(SubpixelScale) - 0.5f) - plane.dy * (y0 / float(SubpixelScale) - 0.5f);
+            return plane;
+        };
+        tri.depth = makePlane(v0.depth, v1.depth, v2.depth);
+        tri.nearestDepth = std::max({v0.depth, v1.depth, v2.depth});
+
+        // * перспективно-корректно: линейны в экране атрибуты, деленные на w (то есть умноженные на depth)
+        if (shadowed) {
+            tri.shadowX = makePlane(v0.shadowX * v0.depth, v1.shadowX * v1.depth, v2.shadowX * v2.depth);
+            tri.shadowY = makePlane(v0.shadowY * v0.depth, v1.shadowY * v1.depth, v2.shadowY * v2.depth);
+            tri.shadowW = makePlane(v0.shadowW * v0.depth, v1.shadowW * v1.depth, v2.shadowW * v2.depth);
+        }
+        int varyingCount = shading == GouraudShading ? 3 : shading == PhongShading ? 6 : 0;
+        for (int i = 0; i < varyingCount; ++i) {
+            tri.varyings[i] = makePlane(v0.varyings[i] * v0.depth, v1.varyings[i] * v1.depth, v2.varyings[i] * v2.depth);
+        }
+        tri.color = color;
+        tri.shadowColor = shadowColor;
+        tri.shadowed = shadowed;
+        tri.shading = shading;
+
+        // * биннинг по ограничивающему прямоугольнику, порядок в каждом бине = порядок отправки
+        uint32_t index = uint32_t(triangles.size());
+        triangles.push_back(tri);
+        ++triangleCount;
+        for (int ty = tri.minY / TileSize; ty <= tri.maxY / TileSize; ++ty) {
+            for (int tx = tri.minX / TileSize; tx <= tri.maxX / TileSize; ++tx) {
+                bins[size_t(ty) * tilesX + tx].push_back(index);
+            }
+        }
+    }
+
+    static Edge makeEdge(int64_t ax, int64_t ay, int64_t bx, int64_t by) {
+        Edge e;
+        e.a = ay - by;
+        e.b = bx - ax;
+        e.c = -(e.a * ax + e.b * ay);
+        // * top-left: пиксель на общем ребре достается ровно одному из двух треугольников
+        bool topLeft = e.a > 0 || (e.a == 0 && e.b < 0);
+        if (!topLeft) {
+            e.c -= 1;
+        }
+        e.stepX = e.a * SubpixelScale;
+        e.stepY = e.b * SubpixelScale;
+        return e;
+    }
+
+    void rasterizeTile(int tile, const Target& target) {
+        int tileX = (tile % tilesX) * TileSize;
+        int tileY = (tile / tilesX) * TileSize;
+        int tileEndX = std::min(tileX + TileSize, width);
+        int tileEndY = std::min(tileY + TileSize, height);
+
+        if (clearPending) {
+            for (int y = tileY; y < tileEndY; ++y) {
+                QRgb* colorRow = target.row(y);
+                float* depthRow = depthBuffer.data() + size_t(y) * width;
+                if (colorWrites) {
+                    std::fill(colorRow + tileX, colorRow + tileEndX, clearColor);
+                }
+                std::fill(depthRow + tileX, depthRow + tileEndX, 0.0f); // * 1/w = 0 -> бесконечно далеко
+            }
+            for (int by = tileY / BlockSize; by * BlockSize < tileEndY; ++by) {
+                float* farthest = blockFarthest.data() + size_t(by) * blocksX;
+                float* nearest = blockNearest.data() + size_t(by) * blocksX;
+                std::fill(farthest + tileX / BlockSize, farthest + (tileEndX + BlockSize - 1) / BlockSize, 0.0f);
+                std::fill(nearest + tileX / BlockSize, nearest + (tileEndX + BlockSize - 1) / BlockSize, 0.0f);
+            }
+            tileFarthest[tile] = 0.0f;
+            tileFarthestStale[tile] = 0;
+        }
+
+        uint64_t fragments = 0;
+        for (uint32_t index : bins[tile]) {
+            const Triangle& tri = triangles[index];
+
+            // * треугольник целиком дальше самой дальней точки тайла -> не виден нигде в тайле
+            if (tileFarthestStale[tile]) {
+                float farthest = std::numeric_limits<float>::max();
+                for (int by = tileY / BlockSize; by * BlockSize < tileEndY; ++by) {
+                    const float* row = blockFarthest.data() + size_t(by) * blocksX;
+                    farthest = std::min(farthest, *std::min_element(row + tileX / BlockSize, row + (tileEndX + BlockSize - 1) / BlockSize));
+                }
+                tileFarthest[tile] = farthest;
+                tileFarthestStale[tile] = 0;
+            }
+            if (tri.nearestDepth <= tileFarthest[tile]) {
+                continue;
+            }
+
+            int minX = std::max(tri.minX, tileX) & ~(BlockSize - 1);
+            int minY = std::max(tri.minY, tileY) & ~(BlockSize - 1);
+            int maxX = std::min(tri.maxX, tileEndX - 1);
+            int maxY = std::min(tri.maxY, tileEndY - 1);
+
+            bool farthestChanged = false;
+            for (int by = minY; by <= maxY; by += BlockSize) {
+                for (int bx = minX; bx <= maxX; bx += BlockSize) {
+                    farthestChanged |= rasterizeBlock(tri, bx, by, target, fragments);
+                }
+            }
+            tileFarthestStale[tile] |= farthestChanged;
+        }
+        fragmentCount += fragments;
+    }
+
+    // * возвращает, нужно ли пересчитать самую дальнюю глубину тайла; fragments += записанные пиксели
+    bool rasterizeBlock(const Triangle& tri, int bx, int by, const Target& target, uint64_t& fragments) {
+        int64_t px = int64_t(bx) * SubpixelScale + SubpixelScale / 2;
+        int64_t py = int64_t(by) * SubpixelScale + SubpixelScale / 2;
+        int64_t span = int64_t(BlockSize - 1) * SubpixelScale;
+
+        // * блок снаружи, если хотя бы одна функция отрицательна во всех 4 углах
+        int outside0 = tri.e0.cornersOutside(px, py, span);
+        int outside1 = tri.e1.cornersOutside(px, py, span);
+        int outside2 = tri.e2.cornersOutside(px, py, span);
+        if (outside0 == 4 || outside1 == 4 || outside2 == 4) {
+            return false;
+        }
+
+        bool fullyInside = (outside0 | outside1 | outside2) == 0;
+        int endX = std::min(bx + BlockSize, width);
+        int endY = std::min(by + BlockSize, height);
+
+        // * иерархический z: глубина плоскости на прямоугольнике экстремальна в углах.
+        // * Ближе всего, что уже в блоке -> тест глубины проходят все пиксели; дальше всего -> ни один
+        size_t block = size_t(by / BlockSize) * blocksX + bx / BlockSize;
+        float cornerMin = std::numeric_limits<float>::max();
+        float cornerMax = -cornerMin;
+        for (int corner = 0; corner < 4; ++corner) {
+            float z = tri.depth.at(corner & 1 ? endX - 1 : bx, corner & 2 ? endY - 1 : by);
+            cornerMin = std::min(cornerMin, z);
+            cornerMax = std::max(cornerMax, z);
+        }
+        if (std::min(cornerMax, tri.nearestDepth) <= blockFarthest[block]) {
+            return false;
+        }
+        bool allPass = fullyInside && cornerMin > blockNearest[block];
+
+        // * блок целиком на свету / в тени -> PCF не нужен
+        ShadowMap::Coverage coverage = tri.shadowed && colorWrites ? classifyShadow(tri, bx, by, endX - 1, endY - 1) : ShadowMap::Lit;
+        QRgb blockColor = coverage == ShadowMap::Shadowed ? tri.shadowColor : tri.color;
+
+        // * гладкая закраска: сначала покрытие и тест глубины по строке, потом цвета всей строки разом
+        bool smooth = colorWrites && tri.shading != FlatShading && coverage != ShadowMap::Shadowed;
+
+        int64_t w0Row = tri.e0.at(px, py);
+        int64_t w1Row = tri.e1.at(px, py);
+        int64_t w2Row = tri.e2.at(px, py);
+        int written = 0;
+
+        for (int y = by; y < endY; ++y) {
+            QRgb* colorRow = target.row(y);
+            float* depthRow = depthBuffer.data() + size_t(y) * width;
+            float z = tri.depth.at(bx, y);
+            int64_t w0 = w0Row, w1 = w1Row, w2 = w2Row;
+            unsigned visible = 0; // * биты пикселей строки, прошедших тест глубины
+
+            if (allPass) {
+                // * без тестов покрытия и глубины
+                for (int x = bx; x < endX; ++x) {
+                    depthRow[x] = z;
+                    if (!smooth && colorWrites) {
+                        colorRow[x] = coverage == ShadowMap::Partial ? shade(tri, x, y, z) : blockColor;
+                    }
+                    z += tri.depth.dx;
+                }
+                visible = smooth ? (1u << (endX - bx)) - 1 : 0;
+            } else {
+                for (int x = bx; x < endX; ++x) {
+                    if (fullyInside || (w0 | w1 | w2) >= 0) {
+                        if (z > depthRow[x]) {
+                            depthRow[x] = z;
+                            ++written;
+                            if (smooth) {
+                                visible |= 1u << (x - bx);
+                            } else if (colorWrites) {
+                                colorRow[x] = coverage == ShadowMap::Partial ? shade(tri, x, y, z) : blockColor;
+                            }
+                        }
+                    }
+                    w0 += tri.e0.stepX;
+                    w1 += tri.e1.stepX;
+                    w2 += tri.e2.stepX;
+                    z += tri.depth.dx;
+                }
+            }
+
+            if (visible == 0xffu && coverage == ShadowMap::Lit) {
+                shadeSpan(tri, bx, y, colorRow + bx); // * вся строка блока внутри экрана и видима
+            } else if (visible) {
+                QRgb span[BlockSize];
+                shadeSpan(tri, bx, y, span);
+                for (int i = 0; i < BlockSize; ++i) {
+                    if (!(visible >> i & 1)) {
+                        continue;
+                    }
+                    QRgb color = span[i];
+                    if (coverage == ShadowMap::Partial) {
+                        color = mixColor(tri.shadowColor, color, litFactor(tri, bx + i, y, depthRow[bx + i]));
+                    }
+                    colorRow[bx + i] = color;
+                }
+            }
+
+            w0Row += tri.e0.stepY;
+            w1Row += tri.e1.stepY;
+            w2Row += tri.e2.stepY;
+        }
+
+        float farthest = blockFarthest[block];
+        if (allPass) {
+            // * весь блок теперь - плоскость треугольника; запас на погрешность пошагового z
+            blockFarthest[block] = cornerMin * (1 - 1e-5f);
+            blockNearest[block] = cornerMax * (1 + 1e-5f);
+            fragments += uint64_t(endX - bx) * (endY - by);
+        } else if (written) {
+            updateBlockDepthRange(block, bx, by, endX, endY);
+            fragments += written;
+        }
+        // * минимум по тайлу мог сдвинуться, только если этот блок и был самым дальним
+        return blockFarthest[block] != farthest && farthest <= tileFarthest[size_t(by / TileSize) * tilesX + bx / TileSize];
+    }
+
+    void updateBlockDepthRange(size_t block, int bx, int by, int endX, int endY) {
+        float farthest = std::numeric_limits<float>::max();
+        float nearest = 0.0f;
+        if (endX - bx == BlockSize) {
+            // * полосами SimdFloat: независимые min/max по столбцам, свертка в конце
+            SimdFloat farLanes[BlockSize / SimdFloat::Width];
+            SimdFloat nearLanes[BlockSize / SimdFloat::Width];
+            for (int i = 0; i < BlockSize / SimdFloat::Width; ++i) {
+                farLanes[i] = SimdFloat::broadcast(farthest);
+                nearLanes[i] = SimdFloat::broadcast(nearest);
+            }
+            for (int y = by; y < endY; ++y) {
+                const float* depthRow = depthBuffer.data() + size_t(y) * width + bx;
+                for (int i = 0; i < BlockSize / SimdFloat::Width; ++i) {
+                    SimdFloat z = SimdFloat::load(depthRow + i * SimdFloat::Width);
+                    farLanes[i] = SimdFloat::min(farLanes[i], z);
+                    nearLanes[i] = SimdFloat::max(nearLanes[i], z);
+                }
+            }
+            float farValues[BlockSize], nearValues[BlockSize];
+            for (int i = 0; i < BlockSize / SimdFloat::Width; ++i) {
+                farLanes[i].store(farValues + i * SimdFloat::Width);
+                nearLanes[i].store(nearValues + i * SimdFloat::Width);
+            }
+            farthest = *std::min_element(farValues, farValues + BlockSize);
+            nearest = *std::max_element(nearValues, nearValues + BlockSize);
+        } else {
+            for (int y = by; y < endY; ++y) {
+                const float* depthRow = depthBuffer.data() + size_t(y) * width;
+                for (int x = bx; x < endX; ++x) {
+                    farthest = std::min(farthest, depthRow[x]);
+                    nearest = std::max(nearest, depthRow[x]);
+                }
+            }
+        }
+        blockFarthest[block] = farthest;
+        blockNearest[block] = nearest;
+    }
+
+    // * цвета пикселей [x, x + BlockSize) строки y. Атрибуты/w линейны в экране: интерполируются
+    // * по SimdFloat::Width пикселей за раз и делятся на интерполированную 1/w (перспективно-корректно)
+    void shadeSpan(const Triangle& tri, int x, int y, QRgb* out) const {
+        static const float offsets[BlockSize] = {0, 1, 2, 3, 4, 5, 6, 7};
+        const float fx = float(x);
+        const float fy = float(y);
+        const SimdFloat zero = SimdFloat::broadcast(0.0f);
+        const SimdFloat full = SimdFloat::broadcast(255.0f);
+        SimdFloat rgb[3];
+
+        for (int i = 0; i < BlockSize; i += SimdFloat::Width) {
+            SimdFloat offset = SimdFloat::load(offsets + i);
+            auto interpolate = [&](const Plane& plane) {
+                return SimdFloat::mulAdd(SimdFloat::broadcast(plane.dx), offset, SimdFloat::broadcast(plane.at(fx, fy)));
+            };
+            SimdFloat w = SimdFloat::broadcast(1.0f) / interpolate(tri.depth);
+
+            if (tri.shading == GouraudShading) {
+                for (int c = 0; c < 3; ++c) {
+                    rgb[c] = SimdFloat::min(SimdFloat::max(interpolate(tri.varyings[c]) * w, zero), full);
+                }
+                SimdFloat::storeRgb(rgb[0], rgb[1], rgb[2], out + i);
+                continue;
+            }
+
+            // * Фонг: cos = n . l / (|n| |l|), l - направление из точки на источник
+            SimdFloat n[3], l[3];
+            for (int c = 0; c < 3; ++c) {
+                n[c] = interpolate(tri.varyings[c]) * w;
+                l[c] = SimdFloat::broadcast(light[c]) - interpolate(tri.varyings[3 + c]) * w;
+            }
+            SimdFloat nl = SimdFloat::mulAdd(n[0], l[0], SimdFloat::mulAdd(n[1], l[1], n[2] * l[2]));
+            SimdFloat nn = SimdFloat::mulAdd(n[0], n[0], SimdFloat::mulAdd(n[1], n[1], n[2] * n[2]));
+            SimdFloat ll = SimdFloat::mulAdd(l[0], l[0], SimdFloat::mulAdd(l[1], l[1], l[2] * l[2]));
+            SimdFloat cosine = SimdFloat::max(nl, zero) / SimdFloat::sqrt(nn * ll + SimdFloat::broadcast(1e-20f));
+
+            for (int c = 0; c < 3; ++c) {
+                rgb[c] = SimdFloat::min(SimdFloat::max(cosine * SimdFloat::broadcast(lightDiffuse[c]), SimdFloat::broadcast(lightAmbient[c])), full);
+            }
+            SimdFloat::storeRgb(rgb[0], rgb[1], rgb[2], out + i);
+        }
+    }
+
+    // * пиксель с тенью: восстанавливаем координаты в карте теней и смешиваем цвета
+    QRgb shade(const Triangle& tri, int x, int y, float z) const {
+        return mixColor(tri.shadowColor, tri.color, litFactor(tri, x, y, z));
+    }
+
+    // * доля света в пикселе по карте теней (PCF), 1 - полностью освещен
+    float litFactor(const Triangle& tri, int x, int y, float z) const {
+        float sw = tri.shadowW.at(x, y);
+        if (sw <= 0.0f) {
+            return 1.0f; // * точка позади источника
+        }
+        return shadowMap->lit(tri.shadowX.at(x, y) / sw, tri.shadowY.at(x, y) / sw, sw / z);
+    }
+
+    // * координаты в карте теней в углах блока: и u, v, и w источника на плоскости треугольника
+    // * экстремальны в углах, так что хватает 4 точек
+    ShadowMap::Coverage classifyShadow(const Triangle& tri, int x0, int y0, int x1, int y1) const {
+        float u0 = std::numeric_limits<float>::max(), v0 = u0, w0 = u0;
+        float u1 = -u0, v1 = -u0, w1 = -u0;
+        for (int corner = 0; corner < 4; ++corner) {
+            int x = corner & 1 ? x1 : x0;
+            int y = corner & 2 ? y1 : y0;
+            float z = tri.depth.at(x, y);
+            float sw = tri.shadowW.at(x, y);
+            if (sw <= 0.0f || z <= 0.0f) {
+                return ShadowMap::Partial;
+            }
+            float u = tri.shadowX.at(x, y) / sw;
+            float v = tri.shadowY.at(x, y) / sw;
+            float w = sw / z;
+            u0 = std::min(u0, u); u1 = std::max(u1, u);
+            v0 = std::min(v0, v); v1 = std::max(v1, v);
+            w0 = std::min(w0, w); w1 = std::max(w1, w);
+        }
+        return shadowMap->classify(u0, v0, u1, v1, w0, w1);
+    }
+
+    static QRgb mixColor(QRgb a, QRgb b, float t) {
+        return qRgb(int(qRed(a) + (qRed(b) - qRed(a)) * t),
+                    int(qGreen(a) + (qGreen(b) - qGreen(a)) * t),
+                    int(qBlue(a) + (qBlue(b) - qBlue(a)) * t));
+    }
+
+    int width = 0;
+    int height = 0;
+    int tilesX = 0;
+    int tilesY = 0;
+    QImage colorBuffer;
+    std::vector<float> depthBuffer;
+    // * иерархический z по блокам BlockSize x BlockSize: самая дальняя и самая ближняя 1/w в блоке,
+    // * плюс самая дальняя по тайлу (пересчитывается лениво, когда в тайл что-то записали)
+    int blocksX = 0;
+    std::vector<float> blockFarthest;
+    std::vector<float> blockNearest;
+    std::vector<float> tileFarthest;
+    std::vector<uint8_t> tileFarthestStale;
+    QRgb clearColor = 0;
+    bool clearPending = true;
+    bool colorWrites = true;
+    const ShadowMap* shadowMap = nullptr;
+    Shading shading = FlatShading;
+    float light[3] = {0, 0, 0};
+    float lightDiffuse[3] = {255, 255, 255};
+    float lightAmbient[3] = {0, 0, 0};
+    std::vector<Triangle> triangles;
+    std::vector<std::vector<uint32_t>> bins; // * индексы треугольников для каждого тайла
+    QThreadPool threadPool;
+    uint64_t triangleCount = 0;
+    std::atomic<uint64_t> fragmentCount{0}; // * тайлы добавляют свои счетчики из разных потоков
+    double fillSeconds = 0;
+};
+
+// * объект сцены: диапазон вершин и уровни детализации (диапазоны треугольников) общей сетки
+// * + ограничивающая сфера для отсечения по пирамиде видимости
+struct SceneObject {
+    uint32_t firstVertex;
+    uint32_t vertexCount;
+    std::vector<Mesh::Level> levels;
+    size_t level; // * выбранный в прошлом кадре уровень, от него считается гистерезис
+    Vertex3D center;
+    double radius;
 };
 
 class ShadowRenderer : public QWidget {
+public:
+    // * замеры последнего кадра. setup - все, что не преобразование вершин и не растеризация:
+    // * отсечение, клиппинг, setup треугольников и биннинг (и перестройка кэшей, если была)
+    struct FrameStats {
+        uint64_t triangles; // * дошли до растеризатора
+        uint64_t fragments; // * записанные пиксели
+        double frameSeconds;
+        double transformSeconds;
+        double setupSeconds;
+        double fillSeconds;
+    };
+
 private:
-    std::vector<Vertex3D> vertices;
-    std::vector<Face> faces;
+    Mesh mesh; // * вся сцена в одной сетке, объекты ссылаются на ее диапазоны
+    std::vector<SceneObject> objects;
     Vertex3D lightSource;
+    SoftwareRasterizer rasterizer;
+
+    // * данные треугольников, которые не зависят от камеры: пересчитываются только при смене геометрии/света
+    struct FaceCache {
+        float nx, ny, nz; // * единичная нормаль
+        QRgb color;
+        QRgb shadowColor; // * цвет той же грани в тени (только фоновая подсветка)
+    };
+    std::vector<FaceCache> faceCache;
+
+    // * закраска (S переключает): плоская по граням, Гуро по цветам вершин или Фонг по нормалям вершин
+    SoftwareRasterizer::Shading shading = SoftwareRasterizer::FlatShading;
+    std::vector<QRgb> vertexColor; // * освещение в вершинах для Гуро, тоже зависит только от геометрии/света
+    uint64_t vertexColorGeometryRevision = 0;
+    uint64_t vertexColorLightRevision = 0;
+
+    // * каждая вершина видимого объекта проецируется один раз за кадр, треугольники берут ее по индексу
+    VertexCache projected;
+    uint64_t geometryRevision = 1;
+    uint64_t lightRevision = 1;
+    uint64_t cachedGeometryRevision = 0;
+    uint64_t cachedLightRevision = 0;
+
+    // * карта теней: сцена из источника света, перестраивается только при смене геометрии/света
+    static const int shadowMapSize = 1024;
+    SoftwareRasterizer shadowPass;
+    ShadowMap shadowMap;
+    uint64_t shadowGeometryRevision = 0;
+    uint64_t shadowLightRevision = 0;
+    VertexCache lightProjected; // * тот же кэш для прохода из источника
+
+    // * камера источника: базис, фокус в текселях и ближняя плоскость по оси forward.
+    // * clip дает однородные (x, y, w, w) в карте теней, projection - (x / w, y / w, 1 / w)
+    struct LightView {
+        Vertex3D right, up, forward;
+        double focal;
+        double nearPlane;
+        Matrix4 clip;
+        Matrix4 projection;
+    } lightView;
+
+    // * что поменялось с последнего кадра; кадр перерисовывается, только если что-то поменялось
+    enum DirtyFlag {
+        DirtyGeometry = 1 << 0,
+        DirtyLight = 1 << 1,
+        DirtyViewport = 1 << 2,
+        DirtyShading = 1 << 3,
+    };
+    int dirty = DirtyGeometry | DirtyLight | DirtyViewport;
+
+    // * анимация света (пробел): таймер работает только пока анимация включена
+    QTimer* animationTimer;
+    double lightAngle = 0.0;
+
+    FrameStats stats = {};
+
+    static constexpr double focalLength = 2.0; // * d в проекции x / (z / d + 1)
+    static constexpr double pixelScale = 100.0;
+    static constexpr double nearW = 0.1; // * ближняя плоскость: w = z / d + 1 >= nearW
+    static constexpr double lodTolerance = 1.0; // * допустимая ошибка упрощенного уровня на экране, пикселей
+    static constexpr double lodHysteresis = 0.7; // * более грубый уровень берется, только если его ошибка < tolerance * 0.7
 
 public:
     ShadowRenderer(QWidget* parent = nullptr) : QWidget(parent) {
-        vertices = {
+        const float cubeVertices[8][3] = {
             {-1, -1, -1}, {1, -1, -1}, {1, 1, -1}, {-1, 1, -1},
             {-1, -1, 1},  {1, -1, 1},  {1, 1, 1},  {-1, 1, 1}
         };
-
-        faces = {
-            Face{{0, 1, 2, 3}}, Face{{4, 5, 6, 7}},
-            Face{{0, 1, 5, 4}}, Face{{1, 2, 6, 5}},
-            Face{{2, 3, 7, 6}}, Face{{3, 0, 4, 7}}
+        // * все грани обходятся так, что нормаль (v1 - v0) x (v2 - v0) смотрит наружу
+        const uint32_t cubeFaces[6][4] = {
+            {0, 3, 2, 1}, {4, 5, 6, 7},
+            {0, 1, 5, 4}, {1, 2, 6, 5},
+            {2, 3, 7, 6}, {3, 0, 4, 7}
         };
 
+        // * у каждой грани свои 4 вершины, чтобы при гладкой закраске ребра куба остались острыми
+        Mesh cube;
+        for (const auto& face : cubeFaces) {
+            uint32_t quad[4];
+            for (int i = 0; i < 4; ++i) {
+                const float* v = cubeVertices[face[i]];
+                quad[i] = cube.addVertex(v[0], v[1], v[2]);
+            }
+            cube.addPolygon(quad, 4);
+        }
+        setScene(cube);
+
+        shadowPass.setColorWrites(false);
+        shadowPass.resize(shadowMapSize, shadowMapSize);
+        rasterizer.setShadowMap(&shadowMap);
+
+        setLightSource({-12, 8, 5}); // * положение источника света (выше пола, иначе теней не видно)
+
+        setFocusPolicy(Qt::StrongFocus);
+
+        animationTimer = new QTimer(this);
+        connect(animationTimer, &QTimer::timeout, this, [this]() {
+            // * вращаем источник света вокруг оси y
+            lightAngle += 0.02;
+            double radius = std::sqrt(lightSource.x * lightSource.x + lightSource.z * lightSource.z);
+            setLightSource({-radius * std::cos(lightAngle), lightSource.y, radius * std::sin(lightAngle)});
+        });
+    }
+
+    void setAnimating(bool animating) {
+        if (animating) {
+            lightAngle = std::atan2(lightSource.z, -lightSource.x);
+            animationTimer->start(16);
+        } else {
+            animationTimer->stop();
+        }
+    }
+
+    void setShading(SoftwareRasterizer::Shading mode) {
+        shading = mode;
+        invalidate(DirtyShading);
+    }
+
+    void setLightSource(const Vertex3D& position) {
+        lightSource = position;
+        ++lightRevision;
+        invalidate(DirtyLight);
+    }
+
+    // * модель из OBJ/PLY вместо куба
+    bool loadModel(const QString& path) {
+        Mesh model;
+        if (!loadMesh(path, model)) {
+            return false;
+        }
+        setModel(std::move(model));
+        return true;
+    }
+
+    // * модель вписывается в тот же куб [-1, 1]^3. Упрощенные уровни строятся здесь же, один раз
+    void setModel(Mesh model, bool levelsOfDetail = true) {
+        float lo[3] = {model.x[0], model.y[0], model.z[0]};
+        float hi[3] = {lo[0], lo[1], lo[2]};
+        for (uint32_t i = 0; i < model.vertexCount(); ++i) {
+            lo[0] = std::min(lo[0], model.x[i]); hi[0] = std::max(hi[0], model.x[i]);
+            lo[1] = std::min(lo[1], model.y[i]); hi[1] = std::max(hi[1], model.y[i]);
+            lo[2] = std::min(lo[2], model.z[i]); hi[2] = std::max(hi[2], model.z[i]);
+        }
+        float extent = std::max({hi[0] - lo[0], hi[1] - lo[1], hi[2] - lo[2]});
+        float k = extent > 0 ? 2.0f / extent : 1.0f;
+        for (uint32_t i = 0; i < model.vertexCount(); ++i) {
+            model.x[i] = (model.x[i] - (lo[0] + hi[0]) / 2) * k;
+            model.y[i] = (model.y[i] - (lo[1] + hi[1]) / 2) * k;
+            model.z[i] = (model.z[i] - (lo[2] + hi[2]) / 2) * k;
+        }
+
+        if (levelsOfDetail) {
+            buildLevels(model);
+        }
+        setScene(std::move(model));
+    }
+
+    void setThreadCount(int count) {
+        rasterizer.setThreadCount(count);
+        shadowPass.setThreadCount(count);
+    }
 
-        lightSource = {-12, 0, 5}; // * положение источника света
+    // * кадр без окна (для замеров): рисуется заново, даже если ничего не поменялось
+    const QImage& renderOffscreen() {
+        renderFrame();
+        dirty = 0;
+        return rasterizer.image();
+    }
 
-        QTimer* timer = new QTimer(this);
-        connect(timer, &QTimer::timeout, this, &ShadowRenderer::update);
-        timer->start(16);
+    const FrameStats& frameStats() const {
+        return stats;
     }
 
 protected:
     void paintEvent(QPaintEvent*) override {
+        // * expose/перекрытие окна без изменений сцены -> просто выводим готовый кадр
+        if (dirty) {
+            renderFrame();
+            dirty = 0;
+        }
+
         QPainter painter(this);
+        painter.drawImage(0, 0, rasterizer.image());
         painter.setRenderHint(QPainter::Antialiasing);
 
+        const double d = focalLength;
+        if (lightSource.z / d + 1 >= nearW) {
+            // * перспективная проекция
+            double x = lightSource.x / (lightSource.z / d + 1) * pixelScale;
+            double y = lightSource.y / (lightSource.z / d + 1) * pixelScale;
+            QPoint lightPosition(width() / 2 + x, height() / 2 - y);
+            painter.setBrush(Qt::yellow);
+            painter.setPen(Qt::black);
+            painter.drawEllipse(lightPosition, 5, 5);
+        }
+    }
+
+    void resizeEvent(QResizeEvent*) override {
+        invalidate(DirtyViewport);
+    }
+
+    void keyPressEvent(QKeyEvent* event) override {
+        double step = 0.5;
+        switch (event->key()) {
+        case Qt::Key_Space:
+            setAnimating(!animationTimer->isActive());
+            break;
+        case Qt::Key_S:
+            setShading(SoftwareRasterizer::Shading((shading + 1) % 3));
+            break;
+        case Qt::Key_Left:
+            setLightSource({lightSource.x - step, lightSource.y, lightSource.z});
+            break;
+        case Qt::Key_Right:
+            setLightSource({lightSource.x + step, lightSource.y, lightSource.z});
+            break;
+        case Qt::Key_Up:
+            setLightSource({lightSource.x, lightSource.y + step, lightSource.z});
+            break;
+        case Qt::Key_Down:
+            setLightSource({lightSource.x, lightSource.y - step, lightSource.z});
+            break;
+        default:
+            QWidget::keyPressEvent(event);
+        }
+    }
+
+private:
+    // * помечает кадр грязным; update() сам склеивает несколько вызовов в одну перерисовку
+    void invalidate(int flags) {
+        dirty |= flags;
+        QWidget::update();
+    }
+
+    // * сцена: модель + пол, чтобы было куда падать тени
+    void setScene(Mesh model) {
+        mesh = Mesh();
+        objects.clear();
+        model.computeNormals();
+        addObject(model);
+
+        Mesh floor;
+        floor.addVertex(-8, -1.5f, -1.5f);
+        floor.addVertex(-8, -1.5f, 10);
+        floor.addVertex(8, -1.5f, 10);
+        floor.addVertex(8, -1.5f, -1.5f);
+        const uint32_t quad[4] = {0, 1, 2, 3};
+        floor.addPolygon(quad, 4);
+        floor.computeNormals();
+        addObject(floor);
+    }
+
+    // * дописывает сетку (с нормалями и уровнями) в общую и регистрирует ее как один объект
+    void addObject(const Mesh& part) {
+        SceneObject object{mesh.vertexCount(), part.vertexCount(), part.levels, 0, {0, 0, 0}, 0.0};
+        if (object.levels.empty()) {
+            object.levels.push_back({0, part.triangleCount(), 0.0f});
+        }
+        for (Mesh::Level& level : object.levels) {
+            level.firstTriangle += mesh.triangleCount();
+        }
+
+        mesh.x.insert(mesh.x.end(), part.x.begin(), part.x.end());
+        mesh.y.insert(mesh.y.end(), part.y.begin(), part.y.end());
+        mesh.z.insert(mesh.z.end(), part.z.begin(), part.z.end());
+        mesh.nx.insert(mesh.nx.end(), part.nx.begin(), part.nx.end());
+        mesh.ny.insert(mesh.ny.end(), part.ny.begin(), part.ny.end());
+        mesh.nz.insert(mesh.nz.end(), part.nz.begin(), part.nz.end());
+        mesh.indices.reserve(mesh.indices.size() + part.indices.size());
+        for (uint32_t index : part.indices) {
+            mesh.indices.push_back(object.firstVertex + index);
+        }
+
+        Vertex3D lo = vertex(object.firstVertex);
+        Vertex3D hi = lo;
+        for (uint32_t i = object.firstVertex; i < object.firstVertex + object.vertexCount; ++i) {
+            Vertex3D v = vertex(i);
+            lo = {std::min(lo.x, v.x), std::min(lo.y, v.y), std::min(lo.z, v.z)};
+            hi = {std::max(hi.x, v.x), std::max(hi.y, v.y), std::max(hi.z, v.z)};
+        }
+        object.center = {(lo.x + hi.x) / 2, (lo.y + hi.y) / 2, (lo.z + hi.z) / 2};
+        for (uint32_t i = object.firstVertex; i < object.firstVertex + object.vertexCount; ++i) {
+            object.radius = std::max(object.radius, length(sub(vertex(i), object.center)));
+        }
+
+        objects.push_back(object);
+        ++geometryRevision;
+        invalidate(DirtyGeometry);
+    }
+
+    Vertex3D vertex(uint32_t index) const {
+        return {mesh.x[index], mesh.y[index], mesh.z[index]};
+    }
+
+    void renderFrame() {
+        QElapsedTimer frameTimer;
+        frameTimer.start();
+        rasterizer.resetStats();
+        double transformSeconds = 0;
+
         int width = this->width();
         int height = this->height();
 
+        rasterizer.resize(width, height);
+        rasterizer.clear(palette().window().color().rgb());
+        updateFaceCache();
+        updateShadowMap();
+        if (shading == SoftwareRasterizer::GouraudShading) {
+            updateVertexColors();
+        }
+        rasterizer.setShading(shading);
+        rasterizer.setLight(float(lightSource.x), float(lightSource.y), float(lightSource.z), lambertColor(1.0), lambertColor(0.0));
+
         // * центр экрана
         int cx = width / 2;
         int cy = height / 2;
 
-        // * перспективная проекция
-        auto project = [&](const Vertex3D& v) -> QPoint {
-            double d = 2.0; // Фокусное расстояние
-            double x = v.x / (v.z / d + 1) * 100;
-            double y = v.y / (v.z / d + 1) * 100;
-            return QPoint(cx + x, cy - y);
+        const double d = focalLength;
+
+        // * перспективная проекция x / (z / d + 1) в виде матрицы: w = z / d + 1,
+        // * экран = (cx + x / w * pixelScale, cy - y / w * pixelScale), глубина 1/w идет в z-буфер
+        const float s = float(pixelScale);
+        const Matrix4 viewProjection = Matrix4::rows({
+            {s, 0, float(cx / d), float(cx)},
+            {0, -s, float(cy / d), float(cy)},
+            {0, 0, 0, 1},
+            {0, 0, float(1 / d), 1},
+        });
+
+        // * та же стадия для одной вершины (вершины, полученные клиппингом)
+        auto projectToScreen = [&](const Vertex3D& v) -> ScreenVertex {
+            float x = float(v.x), y = float(v.y), z = float(v.z);
+            ScreenVertex sv;
+            transformVertices<true>(viewProjection, &x, &y, &z, 0, 1, &sv.x, &sv.y, &sv.depth);
+            transformVertices<false>(lightView.clip, &x, &y, &z, 0, 1, &sv.shadowX, &sv.shadowY, &sv.shadowW);
+            return sv;
         };
 
-        // * отрисовка граней с затенением
-        for (const auto& face : faces) {
-            // * нормаль к грани
-            Vertex3D v1 = vertices[face.vertices[1]];
-            Vertex3D v0 = vertices[face.vertices[0]];
-            Vertex3D v2 = vertices[face.vertices[2]];
-
-            Vertex3D normal = {
-                (v1.y - v0.y) * (v2.z - v0.z) - (v1.z - v0.z) * (v2.y - v0.y),
-                (v1.z - v0.z) * (v2.x - v0.x) - (v1.x - v0.x) * (v2.z - v0.z),
-                (v1.x - v0.x) * (v2.y - v0.y) - (v1.y - v0.y) * (v2.x - v0.x),
-            };
+        // * глаз в (0, 0, -d), смотрит вдоль +z; плоскости пирамиды видимости проходят через глаз,
+        // * нормали смотрят внутрь: n . (p - eye) >= 0 для видимых точек
+        const Vertex3D eye = {0, 0, -d};
+        const double f = d * pixelScale;
+        Vertex3D planes[4] = {
+            {1, 0, cx / f},              // * левая
+            {-1, 0, (width - cx) / f},   // * правая
+            {0, -1, cy / f},             // * верхняя
+            {0, 1, (height - cy) / f},   // * нижняя
+        };
+        for (auto& plane : planes) {
+            plane = scale(plane, 1.0 / length(plane));
+        }
 
-            // * вектор к источнику света
-            Vertex3D lightVector = {
-                lightSource.x - v0.x,
-                lightSource.y - v0.y,
-                lightSource.z - v0.z,
-            };
+        // * атрибуты вершины для гладкой закраски
+        auto vertexVaryings = [&](uint32_t i, float (&varyings)[ScreenVertex::MaxVaryings]) {
+            if (shading == SoftwareRasterizer::GouraudShading) {
+                varyings[0] = float(qRed(vertexColor[i]));
+                varyings[1] = float(qGreen(vertexColor[i]));
+                varyings[2] = float(qBlue(vertexColor[i]));
+            } else if (shading == SoftwareRasterizer::PhongShading) {
+                varyings[0] = mesh.nx[i];
+                varyings[1] = mesh.ny[i];
+                varyings[2] = mesh.nz[i];
+                varyings[3] = mesh.x[i];
+                varyings[4] = mesh.y[i];
+                varyings[5] = mesh.z[i];
+            }
+        };
+        std::vector<Vertex3D> polygon;
+        std::vector<Vertex3D> clipped;
+        projected.resize(mesh.vertexCount(), true);
 
-            // * нормализация векторов
-            auto normalize = [](Vertex3D& v) {
-                double length = std::sqrt(v.x * v.x + v.y * v.y + v.z * v.z);
-                v.x /= length;
-                v.y /= length;
-                v.z /= length;
-            };
+        // * отсечение объектов целиком по ограничивающей сфере
+        std::vector<SceneObject*> visible;
+        for (auto& object : objects) {
+            Vertex3D toCenter = sub(object.center, eye);
+            bool outside = (object.center.z / d + 1) < nearW - object.radius / d;
+            for (const auto& plane : planes) {
+                outside = outside || dot(plane, toCenter) < -object.radius;
+            }
+            if (!outside) {
+                visible.push_back(&object);
+            }
+        }
+
+        // * спереди назад и пачками через flush(): дальние объекты проверяются по иерархическому z
+        // * уже нарисованных ближних. Первый объект идет в z-буфер сразу, дальше пачки растут
+        std::stable_sort(visible.begin(), visible.end(), [](const SceneObject* a, const SceneObject* b) {
+            return a->center.z - a->radius < b->center.z - b->radius;
+        });
+        size_t batchLimit = 1;
+        size_t pendingObjects = 0;
+        uint32_t pendingTriangles = 0;
+
+        for (SceneObject* visibleObject : visible) {
+            SceneObject& object = *visibleObject;
+            if (pendingObjects >= batchLimit || pendingTriangles >= 8192) {
+                rasterizer.flush();
+                batchLimit = std::min<size_t>(batchLimit * 2, 64);
+                pendingObjects = 0;
+                pendingTriangles = 0;
+            }
+
+            // * сфера целиком перед ближней плоскостью -> клиппинг граней не нужен
+            bool needsNearClip = (object.center.z - object.radius) / d + 1 < nearW;
+            if (!needsNearClip && isOccluded(object, cx, cy)) {
+                continue;
+            }
+            const Mesh::Level& level = object.levels[selectLevel(object)];
+            ++pendingObjects;
+            pendingTriangles += level.triangleCount;
+
+            // * вершины за ближней плоскостью тоже проецируются (w может быть <= 0),
+            // * но их треугольники ниже идут через клиппинг и этот кэш не используют
+            size_t begin = object.firstVertex;
+            size_t end = begin + object.vertexCount;
+            const float* x = mesh.x.data();
+            const float* y = mesh.y.data();
+            const float* z = mesh.z.data();
+            QElapsedTimer transformTimer;
+            transformTimer.start();
+            transformVertices<true>(viewProjection, x, y, z, begin, end, projected.x.data(), projected.y.data(), projected.depth.data());
+            transformVertices<false>(lightView.clip, x, y, z, begin, end,
+                                     projected.shadowX.data(), projected.shadowY.data(), projected.shadowW.data());
+            transformSeconds += transformTimer.nsecsElapsed() * 1e-9;
+
+            const uint32_t* index = &mesh.indices[size_t(level.firstTriangle) * 3];
+            for (uint32_t t = level.firstTriangle; t < level.firstTriangle + level.triangleCount; ++t, index += 3) {
+                const FaceCache& cached = faceCache[t];
+
+                // * грань смотрит от наблюдателя -> не рисуем
+                Vertex3D v0 = vertex(index[0]);
+                if (dot({cached.nx, cached.ny, cached.nz}, sub(eye, v0)) <= 0) {
+                    continue;
+                }
+
+                auto draw = [&](const ScreenVertex& a, const ScreenVertex& b, const ScreenVertex& c) {
+                    if (cached.color != cached.shadowColor) {
+                        rasterizer.drawShadowedTriangle(a, b, c, cached.color, cached.shadowColor);
+                    } else {
+                        rasterizer.drawTriangle(a, b, c, cached.color); // * грань и так целиком в тени
+                    }
+                };
+
+                auto behindNear = [&](uint32_t i) { return mesh.z[i] / d + 1 < nearW; };
+                if (!needsNearClip || !(behindNear(index[0]) || behindNear(index[1]) || behindNear(index[2]))) {
+                    ScreenVertex a = projected.at(index[0]);
+                    ScreenVertex b = projected.at(index[1]);
+                    ScreenVertex c = projected.at(index[2]);
+                    vertexVaryings(index[0], a.varyings);
+                    vertexVaryings(index[1], b.varyings);
+                    vertexVaryings(index[2], c.varyings);
+                    draw(a, b, c);
+                    continue;
+                }
+
+                polygon = {v0, vertex(index[1]), vertex(index[2])};
+                clipPolygon(polygon, clipped, [](const Vertex3D& v) { return v.z / focalLength + 1 - nearW; });
+                if (clipped.size() < 3) {
+                    continue;
+                }
+
+                // * атрибуты новых вершин - по барицентрическим координатам в исходном треугольнике
+                float corners[3][ScreenVertex::MaxVaryings] = {};
+                for (int k = 0; k < 3; ++k) {
+                    vertexVaryings(index[k], corners[k]);
+                }
+                auto projectClipped = [&](const Vertex3D& v) {
+                    ScreenVertex sv = projectToScreen(v);
+                    double weights[3];
+                    barycentric(v, polygon[0], polygon[1], polygon[2], weights);
+                    for (int i = 0; i < ScreenVertex::MaxVaryings; ++i) {
+                        sv.varyings[i] = float(weights[0] * corners[0][i] + weights[1] * corners[1][i] + weights[2] * corners[2][i]);
+                    }
+                    return sv;
+                };
+
+                // * проекция обрезанного многоугольника и разбиение веером на треугольники
+                ScreenVertex first = projectClipped(clipped[0]);
+                ScreenVertex prev = projectClipped(clipped[1]);
+                for (size_t i = 2; i < clipped.size(); ++i) {
+                    ScreenVertex curr = projectClipped(clipped[i]);
+                    draw(first, prev, curr);
+                    prev = curr;
+                }
+            }
+        }
+
+        rasterizer.flush();
+
+        SoftwareRasterizer::Stats rasterizerStats = rasterizer.stats();
+        stats.triangles = rasterizerStats.triangles;
+        stats.fragments = rasterizerStats.fragments;
+        stats.frameSeconds = frameTimer.nsecsElapsed() * 1e-9;
+        stats.transformSeconds = transformSeconds;
+        stats.fillSeconds = rasterizerStats.fillSeconds;
+        stats.setupSeconds = std::max(0.0, stats.frameSeconds - transformSeconds - rasterizerStats.fillSeconds);
+    }
+
+    // * уровень детализации по радиусу ограничивающей сферы на экране: самый грубый уровень, чья ошибка
+    // * (доля радиуса) дает не больше lodTolerance пикселей. Огрубляем с запасом lodHysteresis,
+    // * иначе объект на границе двух уровней переключался бы туда-обратно каждый кадр
+    size_t selectLevel(SceneObject& object) const {
+        if (object.levels.size() == 1 || object.radius <= 0) {
+            return 0;
+        }
+        double projectedRadius = object.radius / std::max(object.center.z / focalLength + 1, nearW) * pixelScale;
+        auto errorPixels = [&](size_t level) { return object.levels[level].error / object.radius * projectedRadius; };
+
+        size_t& level = object.level;
+        while (level > 0 && errorPixels(level) > lodTolerance) {
+            --level;
+        }
+        while (level + 1 < object.levels.size() && errorPixels(level + 1) < lodTolerance * lodHysteresis) {
+            ++level;
+        }
+        return level;
+    }
+
+    // * экранный прямоугольник ограничивающего куба сферы: x / w экстремально в его углах (w > 0)
+    bool isOccluded(const SceneObject& object, int cx, int cy) const {
+        const double r = object.radius;
+        double w0 = (object.center.z - r) / focalLength + 1;
+        double w1 = (object.center.z + r) / focalLength + 1;
+        double x0 = std::numeric_limits<double>::max(), y0 = x0;
+        double x1 = -x0, y1 = -x0;
+        for (double w : {w0, w1}) {
+            for (double x : {object.center.x - r, object.center.x + r}) {
+                x0 = std::min(x0, cx + x / w * pixelScale);
+                x1 = std::max(x1, cx + x / w * pixelScale);
+            }
+            for (double y : {object.center.y - r, object.center.y + r}) {
+                y0 = std::min(y0, cy - y / w * pixelScale);
+                y1 = std::max(y1, cy - y / w * pixelScale);
+            }
+        }
+        return rasterizer.isOccluded(float(x0), float(y0), float(x1), float(y1), float(1.0 / w0));
+    }
+
+    void updateFaceCache() {
+        bool geometryChanged = cachedGeometryRevision != geometryRevision;
+        if (!geometryChanged && cachedLightRevision == lightRevision) {
+            return;
+        }
+
+        faceCache.resize(mesh.triangleCount());
+        for (uint32_t t = 0; t < mesh.triangleCount(); ++t) {
+            const uint32_t* index = &mesh.indices[size_t(t) * 3];
+            FaceCache& cached = faceCache[t];
+            Vertex3D v0 = vertex(index[0]);
+
+            // * нормаль к грани; у вырожденных треугольников нулевая (такие всегда отбрасываются)
+            if (geometryChanged) {
+                Vertex3D normal = cross(sub(vertex(index[1]), v0), sub(vertex(index[2]), v0));
+                double normalLength = length(normal);
+                normal = normalLength > 0 ? scale(normal, 1.0 / normalLength) : Vertex3D{0, 0, 0};
+                cached.nx = float(normal.x);
+                cached.ny = float(normal.y);
+                cached.nz = float(normal.z);
+            }
+
+            cached.color = lightColor({cached.nx, cached.ny, cached.nz}, v0);
+            cached.shadowColor = lightColor({0, 0, 0}, v0);
+        }
+
+        cachedGeometryRevision = geometryRevision;
+        cachedLightRevision = lightRevision;
+    }
+
+    void updateVertexColors() {
+        if (vertexColorGeometryRevision == geometryRevision && vertexColorLightRevision == lightRevision) {
+            return;
+        }
+
+        vertexColor.resize(mesh.vertexCount());
+        for (uint32_t i = 0; i < mesh.vertexCount(); ++i) {
+            vertexColor[i] = lightColor({mesh.nx[i], mesh.ny[i], mesh.nz[i]}, vertex(i));
+        }
+
+        vertexColorGeometryRevision = geometryRevision;
+        vertexColorLightRevision = lightRevision;
+    }
+
+    // * цвет точки с единичной нормалью normal (нулевая нормаль -> только фоновая подсветка)
+    QRgb lightColor(const Vertex3D& normal, const Vertex3D& position) const {
+        // * вектор к источнику света
+        Vertex3D lightVector = sub(lightSource, position);
+
+        // * cos угла между нормалью и световым вектором
+        double brightness = dot(normal, lightVector) / length(lightVector);
+
+        return lambertColor(brightness);
+    }
+
+    static QRgb lambertColor(double brightness) {
+        brightness = std::max(0.0, brightness); // * освещение только с одной сторон
+
+        int green = static_cast<int>(brightness * 255);
+        green = std::max(green, 50); // * минимальное значение для зеленого (темно-зеленый)
+        return qRgb(0, green, 0);
+    }
+
+    // * барицентрические координаты точки p, лежащей в плоскости треугольника abc
+    static void barycentric(const Vertex3D& p, const Vertex3D& a, const Vertex3D& b, const Vertex3D& c, double (&weights)[3]) {
+        Vertex3D ab = sub(b, a), ac = sub(c, a), ap = sub(p, a);
+        double d00 = dot(ab, ab), d01 = dot(ab, ac), d11 = dot(ac, ac);
+        double d20 = dot(ap, ab), d21 = dot(ap, ac);
+        double denominator = d00 * d11 - d01 * d01;
+        weights[1] = (d11 * d20 - d01 * d21) / denominator;
+        weights[2] = (d00 * d21 - d01 * d20) / denominator;
+        weights[0] = 1 - weights[1] - weights[2];
+    }
+
+    static Vertex3D sub(const Vertex3D& a, const Vertex3D& b) {
+        return {a.x - b.x, a.y - b.y, a.z - b.z};
+    }
+
+    static Vertex3D scale(const Vertex3D& v, double k) {
+        return {v.x * k, v.y * k, v.z * k};
+    }
+
+    static double dot(const Vertex3D& a, const Vertex3D& b) {
+        return a.x * b.x + a.y * b.y + a.z * b.z;
+    }
+
+    static Vertex3D cross(const Vertex3D& a, const Vertex3D& b) {
+        return {
+            a.y * b.z - a.z * b.y,
+            a.z * b.x - a.x * b.z,
+            a.x * b.y - a.y * b.x,
+        };
+    }
+
+    static double length(const Vertex3D& v) {
+        return std::sqrt(dot(v, v));
+    }
+
+    // * проход из источника света в карту теней. Рисуем только грани, отвернутые от источника:
+    // * для замкнутых тел это убирает самозатенение ("acne") без большого bias
+    void updateShadowMap() {
+        if (shadowGeometryRevision == geometryRevision && shadowLightRevision == lightRevision) {
+            return;
+        }
+
+        updateLightView();
+
+        shadowPass.clear(0);
+        std::vector<Vertex3D> polygon;
+        std::vector<Vertex3D> clipped;
+        auto distanceToNear = [this](const Vertex3D& v) {
+            return dot(sub(v, lightSource), lightView.forward) - lightView.nearPlane;
+        };
+        auto projectToLight = [this](const Vertex3D& v) {
+            float x = float(v.x), y = float(v.y), z = float(v.z);
+            ScreenVertex sv = {0, 0, 0, 0, 0, 0, {}};
+            transformVertices<true>(lightView.projection, &x, &y, &z, 0, 1, &sv.x, &sv.y, &sv.depth);
+            return sv;
+        };
+
+        lightProjected.resize(mesh.vertexCount(), false);
+        transformVertices<true>(lightView.projection, mesh.x.data(), mesh.y.data(), mesh.z.data(), 0, mesh.vertexCount(),
+                                lightProjected.x.data(), lightProjected.y.data(), lightProjected.depth.data());
 
-            normalize(normal);
-            normalize(lightVector);
+        // * вершина перед ближней плоскостью <=> 0 < 1/w <= 1/nearPlane
+        const float maxDepth = float(1.0 / lightView.nearPlane);
+        auto inFront = [&](uint32_t i) {
+            return lightProjected.depth[i] > 0 && lightProjected.depth[i] <= maxDepth;
+        };
 
-            // * cos угла между нормалью и световым вектором
-            double brightness = normal.x * lightVector.x + normal.y * lightVector.y + normal.z * lightVector.z;
+        // * карта теней одна на все положения камеры, поэтому в нее идет полный уровень 0
+        for (const SceneObject& object : objects) {
+            const Mesh::Level& base = object.levels[0];
+            for (uint32_t t = base.firstTriangle; t < base.firstTriangle + base.triangleCount; ++t) {
+                const uint32_t* index = &mesh.indices[size_t(t) * 3];
+                const FaceCache& cached = faceCache[t];
+                if (dot({cached.nx, cached.ny, cached.nz}, sub(lightSource, vertex(index[0]))) > 0) {
+                    continue;
+                }
 
-            brightness = std::max(0.0, brightness); // * освещение только с одной сторон
+                if (inFront(index[0]) && inFront(index[1]) && inFront(index[2])) {
+                    shadowPass.drawTriangle(lightProjected.at(index[0]), lightProjected.at(index[1]), lightProjected.at(index[2]), 0);
+                    continue;
+                }
 
-            int green = static_cast<int>(brightness * 255);
-            green = std::max(green, 50); // * минимальное значение для зеленого (темно-зеленый)
-            painter.setBrush(QColor(0, green, 0));
-            painter.setPen(Qt::NoPen);
+                polygon = {vertex(index[0]), vertex(index[1]), vertex(index[2])};
+                clipPolygon(polygon, clipped, distanceToNear);
+                if (clipped.size() < 3) {
+                    continue;
+                }
 
-            // * проекция граней
-            QPolygon polygon;
-            for (int index : face.vertices) {
-                polygon << project(vertices[index]);
+                ScreenVertex first = projectToLight(clipped[0]);
+                ScreenVertex prev = projectToLight(clipped[1]);
+                for (size_t i = 2; i < clipped.size(); ++i) {
+                    ScreenVertex curr = projectToLight(clipped[i]);
+                    shadowPass.drawTriangle(first, prev, curr, 0);
+                    prev = curr;
+                }
             }
+        }
+        shadowPass.flush();
+
+        shadowMap.size = shadowMapSize;
+        shadowMap.depth = shadowPass.depth();
+        shadowMap.buildTiles();
+        shadowGeometryRevision = geometryRevision;
+        shadowLightRevision = lightRevision;
+    }
 
-            painter.drawPolygon(polygon);
+    // * перспектива из источника, направленная в центр сцены и охватывающая ее целиком
+    void updateLightView() {
+        Vertex3D lo = objects[0].center;
+        Vertex3D hi = lo;
+        for (const auto& object : objects) {
+            lo = {std::min(lo.x, object.center.x - object.radius), std::min(lo.y, object.center.y - object.radius), std::min(lo.z, object.center.z - object.radius)};
+            hi = {std::max(hi.x, object.center.x + object.radius), std::max(hi.y, object.center.y + object.radius), std::max(hi.z, object.center.z + object.radius)};
         }
+        Vertex3D center = scale({lo.x + hi.x, lo.y + hi.y, lo.z + hi.z}, 0.5);
+        double radius = length(sub(hi, lo)) / 2;
+
+        Vertex3D toScene = sub(center, lightSource);
+        double distance = length(toScene);
+        lightView.forward = distance > 0 ? scale(toScene, 1.0 / distance) : Vertex3D{0, 0, 1};
+        Vertex3D worldUp = std::abs(lightView.forward.y) > 0.99 ? Vertex3D{1, 0, 0} : Vertex3D{0, 1, 0};
+        Vertex3D right = cross(worldUp, lightView.forward);
+        lightView.right = scale(right, 1.0 / length(right));
+        lightView.up = cross(lightView.forward, lightView.right);
+
+        // * источник внутри сцены -> просто широкий угол
+        double tanHalf = distance > radius * 1.01 ? radius / std::sqrt(distance * distance - radius * radius) : 3.0;
+        lightView.focal = shadowMapSize / 2.0 / tanHalf;
+        lightView.nearPlane = std::max(0.05, (distance - radius) * 0.5);
+
+        // * тексель = (x / w, y / w), w - расстояние вдоль forward:
+        // * x = half * w + focal * (q . right), y = half * w - focal * (q . up), q = v - lightSource
+        double half = shadowMapSize / 2.0;
+        auto row = [this](const Vertex3D& axis, float (&out)[4]) {
+            out[0] = float(axis.x);
+            out[1] = float(axis.y);
+            out[2] = float(axis.z);
+            out[3] = float(-dot(axis, lightSource));
+        };
+        float rowX[4], rowY[4], rowW[4];
+        row({half * lightView.forward.x + lightView.focal * lightView.right.x,
+             half * lightView.forward.y + lightView.focal * lightView.right.y,
+             half * lightView.forward.z + lightView.focal * lightView.right.z}, rowX);
+        row({half * lightView.forward.x - lightView.focal * lightView.up.x,
+             half * lightView.forward.y - lightView.focal * lightView.up.y,
+             half * lightView.forward.z - lightView.focal * lightView.up.z}, rowY);
+        row(lightView.forward, rowW);
 
-        QPoint lightPosition = project(lightSource);
-        painter.setBrush(Qt::yellow);
-        painter.setPen(Qt::black);
-        painter.drawEllipse(lightPosition, 5, 5);
+        for (int column = 0; column < 4; ++column) {
+            lightView.clip.m[0][column] = lightView.projection.m[0][column] = rowX[column];
+            lightView.clip.m[1][column] = lightView.projection.m[1][column] = rowY[column];
+            lightView.clip.m[2][column] = rowW[column];
+            lightView.clip.m[3][column] = lightView.projection.m[3][column] = rowW[column];
+            lightView.projection.m[2][column] = column == 3 ? 1.0f : 0.0f;
+        }
     }
 
-    void update() {
-        this->repaint();
+    // * Сазерленд-Ходжман по одной плоскости distance(v) >= 0
+    template<class Distance>
+    static void clipPolygon(const std::vector<Vertex3D>& in, std::vector<Vertex3D>& out, Distance distance) {
+        out.clear();
+        for (size_t i = 0; i < in.size(); ++i) {
+            const Vertex3D& a = in[i];
+            const Vertex3D& b = in[(i + 1) % in.size()];
+            double wa = distance(a);
+            double wb = distance(b);
+
+            if (wa >= 0) {
+                out.push_back(a);
+            }
+            if ((wa >= 0) != (wb >= 0)) {
+                double t = wa / (wa - wb);
+                out.push_back({a.x + (b.x - a.x) * t, a.y + (b.y - a.y) * t, a.z + (b.z - a.z) * t});
+            }
+        }
     }
 };
 
+// * замер конвейера без окна: для каждой сетки и разрешения frames кадров после одного прогревочного
+// * (кэши граней и карта теней строятся в нем). На конфигурацию - строка JSON в stdout
+static int runBenchmark(const QStringList& arguments) {
+    QCommandLineParser parser;
+    parser.addOption({"bench", "headless benchmark"});
+    parser.addOption({"frames", "frames per configuration", "count", "50"});
+    parser.addOption({"triangles", "generated torus sizes, comma-separated", "list", "1000,10000,100000,1000000"});
+    parser.addOption({"sizes", "resolutions, comma-separated", "list", "640x480,1280x720,1920x1080"});
+    parser.addOption({"threads", "rasterizer threads", "count", QString::number(QThread::idealThreadCount())});
+    parser.addOption({"shading", "flat, gouraud or phong", "mode", "flat"});
+    parser.addPositionalArgument("models", "OBJ/PLY files to measure instead of the generated tori");
+    parser.process(arguments);
+
+    const int frames = std::max(1, parser.value("frames").toInt());
+    const QStringList shadingNames = {"flat", "gouraud", "phong"};
+    const int shading = std::max(0, int(shadingNames.indexOf(parser.value("shading"))));
+
+    // * сетки: загруженные модели или торы заданных размеров; уровни детализации выключены,
+    // * чтобы замер шел по заданному числу треугольников
+    struct Source {
+        QString name;
+        Mesh mesh;
+    };
+    std::vector<Source> sources;
+    for (const QString& path : parser.positionalArguments()) {
+        Mesh mesh;
+        if (loadMesh(path, mesh)) {
+            sources.push_back({path, std::move(mesh)});
+        }
+    }
+    if (parser.positionalArguments().isEmpty()) {
+        for (const QString& count : parser.value("triangles").split(',', Qt::SkipEmptyParts)) {
+            sources.push_back({"torus", makeTorus(count.toUInt())});
+        }
+    }
+
+    QTextStream out(stdout);
+    for (const Source& source : sources) {
+        ShadowRenderer renderer;
+        renderer.setThreadCount(parser.value("threads").toInt());
+        renderer.setModel(source.mesh, false);
+        renderer.setShading(SoftwareRasterizer::Shading(shading));
+
+        for (const QString& size : parser.value("sizes").split(',', Qt::SkipEmptyParts)) {
+            const QStringList wh = size.split('x');
+            if (wh.size() != 2) {
+                qWarning() << "bad size" << size;
+                continue;
+            }
+            renderer.resize(wh[0].toInt(), wh[1].toInt());
+            renderer.renderOffscreen();
+
+            ShadowRenderer::FrameStats total = {};
+            for (int i = 0; i < frames; ++i) {
+                renderer.renderOffscreen();
+                const ShadowRenderer::FrameStats& frame = renderer.frameStats();
+                total.triangles += frame.triangles;
+                total.fragments += frame.fragments;
+                total.frameSeconds += frame.frameSeconds;
+                total.transformSeconds += frame.transformSeconds;
+                total.setupSeconds += frame.setupSeconds;
+                total.fillSeconds += frame.fillSeconds;
+            }
+
+            QJsonObject result;
+            result["mesh"] = source.name;
+            result["mesh_triangles"] = double(source.mesh.triangleCount());
+            result["width"] = renderer.width();
+            result["height"] = renderer.height();
+            result["threads"] = parser.value("threads").toInt();
+            result["shading"] = shadingNames[shading];
+            result["frames"] = frames;
+            result["frame_ms"] = total.frameSeconds * 1e3 / frames;
+            result["transform_ms"] = total.transformSeconds * 1e3 / frames;
+            result["setup_ms"] = total.setupSeconds * 1e3 / frames;
+            result["fill_ms"] = total.fillSeconds * 1e3 / frames;
+            result["triangles_per_frame"] = double(total.triangles) / frames;
+            result["pixels_per_frame"] = double(total.fragments) / frames;
+            result["triangles_per_second"] = total.triangles / total.frameSeconds;
+            result["pixels_per_second"] = total.fragments / total.frameSeconds;
+            out << QJsonDocument(result).toJson(QJsonDocument::Compact) << "\n";
+            out.flush();
+        }
+    }
+    return 0;
+}
+
 int main(int argc, char* argv[]) {
+    // * --bench: замеры без окна; платформу offscreen нужно выбрать до создания QApplication
+    bool bench = false;
+    for (int i = 1; i < argc; ++i) {
+        bench = bench || std::strcmp(argv[i], "--bench") == 0;
+    }
+    if (bench) {
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
     QApplication app(argc, argv);
+    if (bench) {
+        return runBenchmark(app.arguments());
+    }
 
     ShadowRenderer renderer;
+    // * путь к OBJ/PLY первым аргументом; без него (или если не загрузилась) - куб
+    if (app.arguments().size() > 1) {
+        renderer.loadModel(app.arguments().at(1));
+    }
     renderer.resize(800, 600);
     renderer.show();
 
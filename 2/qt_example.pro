@@ -3,7 +3,7 @@ TARGET = qt_example
 
 INCLUDEPATH += . /opt/homebrew/include
 
-QT += core gui widgets opengl
+QT += core gui widgets opengl concurrent
 
 SOURCES += main.cpp
 
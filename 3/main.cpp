@@ -6,7 +6,20 @@
 #include <QKeyEvent>
 #include <QVector3D>
 #include <QOpenGLFunctions>
+#include <QOpenGLShaderProgram>
+#include <QOpenGLBuffer>
+#include <QOpenGLVertexArrayObject>
+#include <QElapsedTimer>
 #include <QMatrix4x4>
+#include <QtMath>
+#include <QFile>
+#include <QTextStream>
+#include <QCommandLineParser>
+#include <QRegularExpression>
+#include <QSurfaceFormat>
+#include <vector>
+#include <cmath>
+#include <algorithm>
 
 class Camera {
 public:
@@ -14,11 +27,21 @@ public:
     QVector3D targetPosition;
     float speed;
 
+    // * speed - доля пути до цели за один кадр при 60 fps, как было при тике 16 мс
+    static constexpr float referenceStep = 1.0f / 60.0f;
+
     Camera(const QVector3D &startPos)
         : position(startPos), targetPosition(startPos), speed(0.01f) {}
 
-    void updatePosition() {
-        position += (targetPosition - position) * speed;
+    // * экспоненциальное сглаживание по реальному времени: за dt остается exp(-rate * dt) пути,
+    // * поэтому два шага по dt / 2 дают то же, что один шаг по dt, и скорость не зависит от частоты кадров
+    void updatePosition(float dt) {
+        if (speed >= 1.0f) {
+            position = targetPosition;
+            return;
+        }
+        float rate = -std::log(1.0f - speed) / referenceStep;
+        position += (targetPosition - position) * (1.0f - std::exp(-rate * dt));
     }
 
     void setTarget(const QVector3D &target) {
@@ -26,6 +49,93 @@ public:
     }
 };
 
+// * пролет камеры: сплайн Катмулла-Рома через ключевые точки с заданными временами
+class CameraPath {
+public:
+    struct Keyframe {
+        float time;
+        QVector3D position;
+    };
+
+    // * формат файла: строка "время x y z", время в секундах по возрастанию, # - комментарий
+    bool load(const QString &fileName) {
+        QFile file(fileName);
+        if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+            qDebug() << "Cannot open camera path:" << fileName;
+            return false;
+        }
+
+        static const QRegularExpression whitespace("\\s+"); // * поля через пробелы или табуляции
+        std::vector<Keyframe> loaded;
+        QTextStream in(&file);
+        int lineNumber = 0;
+        while (!in.atEnd()) {
+            QString line = in.readLine().section('#', 0, 0).trimmed();
+            ++lineNumber;
+            if (line.isEmpty()) {
+                continue;
+            }
+            QStringList fields = line.split(whitespace, Qt::SkipEmptyParts);
+            bool ok = fields.size() == 4;
+            float values[4] = {};
+            for (int i = 0; ok && i < 4; ++i) {
+                values[i] = fields[i].toFloat(&ok);
+            }
+            if (!ok || (!loaded.empty() && values[0] <= loaded.back().time)) {
+                qDebug() << "Bad keyframe in" << fileName << "line" << lineNumber;
+                return false;
+            }
+            loaded.push_back({values[0], QVector3D(values[1], values[2], values[3])});
+        }
+        if (loaded.empty()) {
+            qDebug() << "No keyframes in" << fileName;
+            return false;
+        }
+
+        keyframes = std::move(loaded);
+        return true;
+    }
+
+    bool isEmpty() const {
+        return keyframes.empty();
+    }
+
+    float duration() const {
+        return keyframes.empty() ? 0.0f : keyframes.back().time;
+    }
+
+    // * позиция в момент time; за краями - первая и последняя точки
+    QVector3D positionAt(float time) const {
+        if (time <= keyframes.front().time) {
+            return keyframes.front().position;
+        }
+        if (time >= keyframes.back().time) {
+            return keyframes.back().position;
+        }
+
+        int i = int(std::upper_bound(keyframes.begin(), keyframes.end(), time,
+                                     [](float t, const Keyframe &k) { return t < k.time; }) - keyframes.begin()) - 1;
+        const Keyframe &k0 = keyframes[std::max(i - 1, 0)];
+        const Keyframe &k1 = keyframes[i];
+        const Keyframe &k2 = keyframes[i + 1];
+        const Keyframe &k3 = keyframes[std::min(i + 2, int(keyframes.size()) - 1)];
+
+        // * касательные по неравномерным временам ключей, на краях - односторонние разности
+        float span = k2.time - k1.time;
+        QVector3D m1 = (k2.position - k0.position) * (span / (k2.time - k0.time));
+        QVector3D m2 = (k3.position - k1.position) * (span / (k3.time - k1.time));
+
+        // * кубический Эрмит на отрезке k1-k2
+        float u = (time - k1.time) / span;
+        float u2 = u * u, u3 = u2 * u;
+        return k1.position * (2 * u3 - 3 * u2 + 1) + m1 * (u3 - 2 * u2 + u)
+             + k2.position * (-2 * u3 + 3 * u2) + m2 * (u3 - u2);
+    }
+
+private:
+    std::vector<Keyframe> keyframes;
+};
+
 class Scene : public QOpenGLWidget, protected QOpenGLFunctions {
     Q_OBJECT
 
@@ -35,16 +145,69 @@ public:
         timer = new QTimer(this);
         connect(timer, &QTimer::timeout, this, &Scene::updateScene);
         timer->start(16);
+        clock.start();
+        // * при повторе кадры идут подряд без таймера: следующий заказывается, как только показан предыдущий
+        connect(this, &QOpenGLWidget::frameSwapped, this, [this]() {
+            if (replaying) {
+                advanceReplay();
+            }
+        });
+    }
+
+    ~Scene() override {
+        // * буферы удаляются только при текущем контексте
+        makeCurrent();
+        for (Mesh* mesh : {&cube, &pyramid, &sphere}) {
+            mesh->vao.destroy();
+            mesh->vertices.destroy();
+            mesh->indices.destroy();
+        }
+        doneCurrent();
     }
 
     void setSpeed(float newSpeed) {
         camera.speed = newSpeed;
     }
 
+    void setPath(const CameraPath &newPath) {
+        path = newPath;
+    }
+
+    // * пролет по пути. При replay путь сдвигается ровно на 1/60 с на каждый нарисованный кадр, независимо
+    // * от часов, и кадры рисуются без ожидания таймера: каждый прогон показывает одни и те же кадры,
+    // * а в конце печатается реальное время на кадр
+    void startFlyThrough(bool replay) {
+        if (path.isEmpty()) {
+            return;
+        }
+        flying = true;
+        replaying = replay;
+        pathTime = 0.0f;
+        camera.position = path.positionAt(0.0f);
+        camera.setTarget(camera.position);
+        frameCount = 0;
+        paintNanoseconds = 0;
+        frameTimer.restart();
+        replayTimer.invalidate(); // * отсчет с первого кадра повтора, без создания окна и контекста
+        replayFrames = 0;
+        update();
+    }
+
+    void stopFlyThrough() {
+        flying = false;
+        replaying = false;
+    }
+
 protected:
     void initializeGL() override {
         initializeOpenGLFunctions();
         glEnable(GL_DEPTH_TEST);
+        initShaders();
+        // * сетки строятся один раз, дальше на кадр - один glDrawElements на объект
+        setupCube();
+        setupPyramid();
+        setupSphere();
+        frameTimer.start();
     }
 
     void resizeGL(int w, int h) override {
@@ -56,6 +219,17 @@ protected:
     }
 
     void paintGL() override {
+        QElapsedTimer paintTimer;
+        paintTimer.start();
+
+        if (replaying) {
+            if (!replayTimer.isValid()) {
+                replayTimer.start();
+            }
+            camera.position = path.positionAt(pathTime);
+            camera.setTarget(camera.position);
+        }
+
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
         QMatrix4x4 viewMatrix;
@@ -63,161 +237,297 @@ protected:
 
         QMatrix4x4 modelView = projectionMatrix * viewMatrix;
 
+        shaderProgram.bind();
+
         QMatrix4x4 cubeMatrix = modelView;
         cubeMatrix.translate(-3.0f, 0.0f, 0.0f);
-        drawCube(cubeMatrix);
+        drawMesh(cube, cubeMatrix);
 
         QMatrix4x4 pyramidMatrix = modelView;
         pyramidMatrix.translate(0.0f, 0.0f, 0.0f);
-        drawPyramid(pyramidMatrix);
+        drawMesh(pyramid, pyramidMatrix);
 
         QMatrix4x4 sphereMatrix = modelView;
         sphereMatrix.translate(3.0f, 0.0f, 0.0f);
-        drawSphere(sphereMatrix);
+        drawMesh(sphere, sphereMatrix);
+
+        shaderProgram.release();
+
+        // * таймер кадров: среднее время paintGL (подготовка и отправка команд на CPU) и интервал между кадрами
+        paintNanoseconds += paintTimer.nsecsElapsed();
+        if (++frameCount == framesPerReport) {
+            qint64 interval = frameTimer.restart();
+            qDebug() << "paintGL:" << paintNanoseconds / 1e6 / frameCount << "ms, frame:" << double(interval) / frameCount << "ms";
+            paintNanoseconds = 0;
+            frameCount = 0;
+        }
     }
 
     void keyPressEvent(QKeyEvent *event) override {
         qDebug() << "Key Pressed:" << event->key();
-        if (event->key() == Qt::Key_1) {
+        if (event->key() == Qt::Key_F) {
+            startFlyThrough(false);
+        } else if (event->key() == Qt::Key_R) {
+            startFlyThrough(true);
+        } else if (event->key() == Qt::Key_Escape) {
+            stopFlyThrough();
+        } else if (event->key() == Qt::Key_1) {
+            stopFlyThrough();
             camera.setTarget(QVector3D(0, 0, 5));
         } else if (event->key() == Qt::Key_2) {
+            stopFlyThrough();
             camera.setTarget(QVector3D(5, 5, 5));
         } else if (event->key() == Qt::Key_3) {
+            stopFlyThrough();
             camera.setTarget(QVector3D(-5, -5, 5));
         } else if (event->key() == Qt::Key_4) {
+            stopFlyThrough();
             camera.setTarget(QVector3D(10, 0, 5));
         } else if (event->key() == Qt::Key_5) {
+            stopFlyThrough();
             camera.setTarget(QVector3D(-10, 0, 5));
         }
     }
 
 private slots:
     void updateScene() {
-        camera.updatePosition();
+        // * шаг по реальному времени; после долгой паузы (перетаскивание окна) не больше 0.1 с
+        float dt = std::min(clock.restart() / 1000.0f, 0.1f);
+
+        if (replaying) {
+            return; // * повтор шагает сам, по frameSwapped
+        }
+        if (flying) {
+            pathTime += dt;
+            camera.position = path.positionAt(pathTime);
+            camera.setTarget(camera.position);
+            if (pathTime >= path.duration()) {
+                flying = false;
+            }
+        } else {
+            camera.updatePosition(dt);
+        }
         update();
     }
 
+signals:
+    void replayFinished();
+
 private:
+    // * кадр повтора показан: фиксированный шаг по пути и сразу следующий кадр,
+    // * в конце - время на кадр по реальным часам
+    void advanceReplay() {
+        ++replayFrames;
+        if (pathTime >= path.duration()) {
+            qint64 elapsed = replayTimer.nsecsElapsed();
+            qDebug() << "Replay:" << replayFrames << "frames in" << elapsed / 1e6 << "ms,"
+                     << elapsed / 1e6 / replayFrames << "ms per frame";
+            stopFlyThrough();
+            emit replayFinished();
+            return;
+        }
+        pathTime = std::min(pathTime + Camera::referenceStep, path.duration());
+        update();
+    }
+
     Camera camera;
     QTimer *timer;
     QMatrix4x4 projectionMatrix;
 
-    void drawCube(const QMatrix4x4 &matrix) {
-        glLoadMatrixf(matrix.constData());
-
-        glBegin(GL_QUADS);
-
-        // * передняя грань
-        glColor3f(1.0f, 0.0f, 0.0f); // * rрасный
-        glVertex3f(-1.0f, -1.0f, 1.0f);
-        glVertex3f(1.0f, -1.0f, 1.0f);
-        glVertex3f(1.0f, 1.0f, 1.0f);
-        glVertex3f(-1.0f, 1.0f, 1.0f);
-
-        // * задняя грань
-        glColor3f(0.0f, 1.0f, 0.0f); // * зеленый
-        glVertex3f(-1.0f, -1.0f, -1.0f);
-        glVertex3f(-1.0f, 1.0f, -1.0f);
-        glVertex3f(1.0f, 1.0f, -1.0f);
-        glVertex3f(1.0f, -1.0f, -1.0f);
-
-        // * левая грань
-        glColor3f(0.0f, 0.0f, 1.0f); // * синий
-        glVertex3f(-1.0f, -1.0f, -1.0f);
-        glVertex3f(-1.0f, -1.0f, 1.0f);
-        glVertex3f(-1.0f, 1.0f, 1.0f);
-        glVertex3f(-1.0f, 1.0f, -1.0f);
-
-        // * правая грань
-        glColor3f(1.0f, 1.0f, 0.0f); // * желтый
-        glVertex3f(1.0f, -1.0f, -1.0f);
-        glVertex3f(1.0f, 1.0f, -1.0f);
-        glVertex3f(1.0f, 1.0f, 1.0f);
-        glVertex3f(1.0f, -1.0f, 1.0f);
-
-        // * верхняя грань
-        glColor3f(0.0f, 1.0f, 1.0f); // * голубой
-        glVertex3f(-1.0f, 1.0f, -1.0f);
-        glVertex3f(-1.0f, 1.0f, 1.0f);
-        glVertex3f(1.0f, 1.0f, 1.0f);
-        glVertex3f(1.0f, 1.0f, -1.0f);
-
-        // * нижняя грань
-        glColor3f(1.0f, 0.0f, 1.0f); // * фиол
-        glVertex3f(-1.0f, -1.0f, -1.0f);
-        glVertex3f(1.0f, -1.0f, -1.0f);
-        glVertex3f(1.0f, -1.0f, 1.0f);
-        glVertex3f(-1.0f, -1.0f, 1.0f);
-
-        glEnd();
+    QElapsedTimer clock;
+    CameraPath path;
+    bool flying = false;
+    bool replaying = false;
+    float pathTime = 0.0f;
+    QElapsedTimer replayTimer;
+    int replayFrames = 0;
+
+    // * вершины чередуются: позиция (3 float), цвет (3 float); треугольники - индексами
+    struct Mesh {
+        QOpenGLVertexArrayObject vao;
+        QOpenGLBuffer vertices{QOpenGLBuffer::VertexBuffer};
+        QOpenGLBuffer indices{QOpenGLBuffer::IndexBuffer};
+        int indexCount = 0;
+    };
+
+    QOpenGLShaderProgram shaderProgram;
+    Mesh cube, pyramid, sphere;
+
+    QElapsedTimer frameTimer;
+    qint64 paintNanoseconds = 0;
+    int frameCount = 0;
+    static const int framesPerReport = 120;
+
+    void initShaders() {
+        // * без #version: GLSL 1.10 есть и в старом контексте по умолчанию, и в compatibility
+        const char *vertexShaderSource = R"(
+            attribute vec3 position;
+            attribute vec3 color;
+            uniform mat4 mvp;
+            varying vec3 fragColor;
+
+            void main() {
+                gl_Position = mvp * vec4(position, 1.0);
+                fragColor = color;
+            }
+        )";
+        const char *fragmentShaderSource = R"(
+            varying vec3 fragColor;
+
+            void main() {
+                gl_FragColor = vec4(fragColor, 1.0);
+            }
+        )";
+
+        if (!shaderProgram.addShaderFromSourceCode(QOpenGLShader::Vertex, vertexShaderSource)
+            || !shaderProgram.addShaderFromSourceCode(QOpenGLShader::Fragment, fragmentShaderSource)) {
+            qDebug() << "Error compiling shaders:" << shaderProgram.log();
+            return;
+        }
+        shaderProgram.bindAttributeLocation("position", 0);
+        shaderProgram.bindAttributeLocation("color", 1);
+        if (!shaderProgram.link()) {
+            qDebug() << "Error linking shader program:" << shaderProgram.log();
+        }
     }
 
-    void drawSphere(const QMatrix4x4 &matrix) {
-        glLoadMatrixf(matrix.constData());
+    // * загрузка в буферы; состояние атрибутов запоминает VAO
+    void upload(Mesh &mesh, const std::vector<GLfloat> &vertices, const std::vector<GLushort> &indices) {
+        mesh.indexCount = int(indices.size());
+        mesh.vao.create(); // * может не получиться на старом контексте - тогда атрибуты ставятся при каждом рисовании
+        QOpenGLVertexArrayObject::Binder binder(&mesh.vao);
 
-        glColor3f(0.5f, 0.5f, 1.0f);
-        const int slices = 20;
-        const int stacks = 20;
+        mesh.vertices.create();
+        mesh.vertices.bind();
+        mesh.vertices.allocate(vertices.data(), int(vertices.size() * sizeof(GLfloat)));
 
-        for (int i = 0; i < stacks; ++i) {
-            float theta1 = (float(i) / stacks) * M_PI;
-            float theta2 = (float(i + 1) / stacks) * M_PI;
+        mesh.indices.create();
+        mesh.indices.bind();
+        mesh.indices.allocate(indices.data(), int(indices.size() * sizeof(GLushort)));
 
-            glBegin(GL_TRIANGLE_STRIP);
-            for (int j = 0; j <= slices; ++j) {
-                float phi = (float(j) / slices) * 2.0f * M_PI;
+        bindAttributes(mesh);
+    }
+
+    void bindAttributes(Mesh &mesh) {
+        mesh.vertices.bind();
+        mesh.indices.bind();
+        shaderProgram.enableAttributeArray(0);
+        shaderProgram.setAttributeBuffer(0, GL_FLOAT, 0, 3, 6 * sizeof(GLfloat));
+        shaderProgram.enableAttributeArray(1);
+        shaderProgram.setAttributeBuffer(1, GL_FLOAT, 3 * sizeof(GLfloat), 3, 6 * sizeof(GLfloat));
+    }
 
-                float x1 = sin(theta1) * cos(phi);
-                float y1 = cos(theta1);
-                float z1 = sin(theta1) * sin(phi);
+    void drawMesh(Mesh &mesh, const QMatrix4x4 &matrix) {
+        shaderProgram.setUniformValue("mvp", matrix);
+        if (mesh.vao.isCreated()) {
+            QOpenGLVertexArrayObject::Binder binder(&mesh.vao);
+            glDrawElements(GL_TRIANGLES, mesh.indexCount, GL_UNSIGNED_SHORT, nullptr);
+        } else {
+            bindAttributes(mesh);
+            glDrawElements(GL_TRIANGLES, mesh.indexCount, GL_UNSIGNED_SHORT, nullptr);
+            mesh.vertices.release();
+            mesh.indices.release();
+        }
+    }
+
+    // * четырехугольник a b c d -> два треугольника
+    static void addQuad(std::vector<GLushort> &indices, GLushort a, GLushort b, GLushort c, GLushort d) {
+        indices.insert(indices.end(), {a, b, c, a, c, d});
+    }
 
-                float x2 = sin(theta2) * cos(phi);
-                float y2 = cos(theta2);
-                float z2 = sin(theta2) * sin(phi);
+    void setupCube() {
+        // * грань: 4 вершины своего цвета
+        const GLfloat faces[6][4][3] = {
+            {{-1.0f, -1.0f, 1.0f}, {1.0f, -1.0f, 1.0f}, {1.0f, 1.0f, 1.0f}, {-1.0f, 1.0f, 1.0f}}, // * передняя грань
+            {{-1.0f, -1.0f, -1.0f}, {-1.0f, 1.0f, -1.0f}, {1.0f, 1.0f, -1.0f}, {1.0f, -1.0f, -1.0f}}, // * задняя грань
+            {{-1.0f, -1.0f, -1.0f}, {-1.0f, -1.0f, 1.0f}, {-1.0f, 1.0f, 1.0f}, {-1.0f, 1.0f, -1.0f}}, // * левая грань
+            {{1.0f, -1.0f, -1.0f}, {1.0f, 1.0f, -1.0f}, {1.0f, 1.0f, 1.0f}, {1.0f, -1.0f, 1.0f}}, // * правая грань
+            {{-1.0f, 1.0f, -1.0f}, {-1.0f, 1.0f, 1.0f}, {1.0f, 1.0f, 1.0f}, {1.0f, 1.0f, -1.0f}}, // * верхняя грань
+            {{-1.0f, -1.0f, -1.0f}, {1.0f, -1.0f, -1.0f}, {1.0f, -1.0f, 1.0f}, {-1.0f, -1.0f, 1.0f}}, // * нижняя грань
+        };
+        const GLfloat colors[6][3] = {
+            {1.0f, 0.0f, 0.0f}, // * красный
+            {0.0f, 1.0f, 0.0f}, // * зеленый
+            {0.0f, 0.0f, 1.0f}, // * синий
+            {1.0f, 1.0f, 0.0f}, // * желтый
+            {0.0f, 1.0f, 1.0f}, // * голубой
+            {1.0f, 0.0f, 1.0f}, // * фиол
+        };
 
-                glVertex3f(x1, y1, z1);
-                glVertex3f(x2, y2, z2);
+        std::vector<GLfloat> vertices;
+        std::vector<GLushort> indices;
+        for (int face = 0; face < 6; ++face) {
+            GLushort first = GLushort(vertices.size() / 6);
+            for (int k = 0; k < 4; ++k) {
+                vertices.insert(vertices.end(), faces[face][k], faces[face][k] + 3);
+                vertices.insert(vertices.end(), colors[face], colors[face] + 3);
             }
-            glEnd();
+            addQuad(indices, first, first + 1, first + 2, first + 3);
         }
+        upload(cube, vertices, indices);
     }
 
-    void drawPyramid(const QMatrix4x4 &matrix) {
-        glLoadMatrixf(matrix.constData());
+    void setupSphere() {
+        // * сетка (stacks + 1) x (slices + 1) вершин, синусы и косинусы считаются только здесь
+        const int slices = 20;
+        const int stacks = 20;
+
+        std::vector<GLfloat> vertices;
+        for (int i = 0; i <= stacks; ++i) {
+            float theta = (float(i) / stacks) * M_PI;
+            for (int j = 0; j <= slices; ++j) {
+                float phi = (float(j) / slices) * 2.0f * M_PI;
+                vertices.insert(vertices.end(), {sinf(theta) * cosf(phi), cosf(theta), sinf(theta) * sinf(phi), 0.5f, 0.5f, 1.0f});
+            }
+        }
 
-        glBegin(GL_TRIANGLES);
+        std::vector<GLushort> indices;
+        for (int i = 0; i < stacks; ++i) {
+            for (int j = 0; j < slices; ++j) {
+                GLushort a = GLushort(i * (slices + 1) + j), b = GLushort(a + slices + 1);
+                addQuad(indices, a, b, b + 1, a + 1);
+            }
+        }
+        upload(sphere, vertices, indices);
+    }
 
-        float apexX = 0.0f, apexY = 1.0f, apexZ = 0.0f;
+    void setupPyramid() {
+        const GLfloat apex[3] = {0.0f, 1.0f, 0.0f};
 
-        float baseVertices[4][3] = {
+        const GLfloat baseVertices[4][3] = {
             {-1.0f, -1.0f, -1.0f},
             {1.0f, -1.0f, -1.0f},
             {1.0f, -1.0f, 1.0f},
             {-1.0f, -1.0f, 1.0f}
         };
 
-        float colors[4][3] = {
+        const GLfloat colors[4][3] = {
             {1.0f, 0.0f, 0.0f},
             {0.0f, 1.0f, 0.0f},
             {0.0f, 0.0f, 1.0f},
             {1.0f, 1.0f, 0.0f}
         };
+        const GLfloat baseColor[3] = {0.5f, 0.5f, 0.5f};
 
+        std::vector<GLfloat> vertices;
+        std::vector<GLushort> indices;
+        // * боковые грани: у каждой свой цвет, поэтому вершина и углы основания у граней свои
         for (int i = 0; i < 4; ++i) {
-            glColor3f(colors[i][0], colors[i][1], colors[i][2]);
-            glVertex3f(apexX, apexY, apexZ);
-            glVertex3f(baseVertices[i][0], baseVertices[i][1], baseVertices[i][2]);
-            glVertex3f(baseVertices[(i + 1) % 4][0], baseVertices[(i + 1) % 4][1], baseVertices[(i + 1) % 4][2]);
+            GLushort first = GLushort(vertices.size() / 6);
+            for (const GLfloat *corner : {apex, baseVertices[i], baseVertices[(i + 1) % 4]}) {
+                vertices.insert(vertices.end(), corner, corner + 3);
+                vertices.insert(vertices.end(), colors[i], colors[i] + 3);
+            }
+            indices.insert(indices.end(), {first, GLushort(first + 1), GLushort(first + 2)});
         }
-
-        glEnd();
-
-        glBegin(GL_QUADS);
-        glColor3f(0.5f, 0.5f, 0.5f);
+        // * основание
+        GLushort first = GLushort(vertices.size() / 6);
         for (int i = 0; i < 4; ++i) {
-            glVertex3f(baseVertices[i][0], baseVertices[i][1], baseVertices[i][2]);
+            vertices.insert(vertices.end(), baseVertices[i], baseVertices[i] + 3);
+            vertices.insert(vertices.end(), baseColor, baseColor + 3);
         }
-        glEnd();
+        addQuad(indices, first, first + 1, first + 2, first + 3);
+        upload(pyramid, vertices, indices);
     }
 };
 
@@ -239,6 +549,10 @@ public:
         layout->addWidget(slider);
     }
 
+    Scene *sceneWidget() const {
+        return scene;
+    }
+
 private:
     Scene *scene;
 };
@@ -246,8 +560,41 @@ private:
 int main(int argc, char **argv) {
     QApplication app(argc, argv);
     qDebug() << "EJFJEFJ\n";
+
+    // * --path файл с ключевыми точками (F - пролет, R - повтор с фиксированным шагом),
+    // * --replay - сразу повторить пролет и выйти, для сравнимых замеров
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    QCommandLineOption pathOption("path", "Camera keyframes: lines of \"time x y z\".", "file");
+    QCommandLineOption replayOption("replay", "Replay the camera path at a fixed step, unthrottled, and quit.");
+    parser.addOption(pathOption);
+    parser.addOption(replayOption);
+    parser.process(app);
+
     MainWindow window;
     window.resize(1000, 800);
+
+    Scene *scene = window.sceneWidget();
+    if (parser.isSet(pathOption)) {
+        CameraPath path;
+        if (!path.load(parser.value(pathOption))) {
+            return 1;
+        }
+        scene->setPath(path);
+    }
+    if (parser.isSet(replayOption)) {
+        if (!parser.isSet(pathOption)) {
+            qDebug() << "--replay needs --path";
+            return 1;
+        }
+        // * для замера повтор не ждет вертикальной синхронизации
+        QSurfaceFormat format = scene->format();
+        format.setSwapInterval(0);
+        scene->setFormat(format);
+        QObject::connect(scene, &Scene::replayFinished, &app, &QApplication::quit);
+        scene->startFlyThrough(true);
+    }
+
     window.show();
 
     return app.exec();
@@ -6,6 +6,9 @@
 #include <cmath>
 #include <QKeyEvent>
 #include <vector>
+#include <QElapsedTimer>
+#include <QFile>
+#include <algorithm>
 
 struct Sphere {
     QVector3D center;
@@ -34,10 +37,13 @@ public:
         setFocus();
     }
 
-protected:
-    void paintEvent(QPaintEvent* event) override {
-        QPainter painter(this);
-        QImage image(width(), height(), QImage::Format_RGB32);
+    void setFocusDistance(float distance) {
+        focusDistance = distance;
+    }
+
+    // * трассировка + размытие в отдельный QImage, не зависит от окна (нужно для headless режима)
+    QImage renderFrame(int w, int h) {
+        QImage image(w, h, QImage::Format_RGB32);
         image.fill(Qt::black);
 
         QVector<Sphere> spheres = {
@@ -52,24 +58,31 @@ protected:
 
         distancedColor b;
         b.color = Qt::black;
-        std::vector<std::vector<distancedColor>> pixels(width(), std::vector<distancedColor>(height(), b));
+        std::vector<std::vector<distancedColor>> pixels(w, std::vector<distancedColor>(h, b));
 
 
-        for (int y = 0; y < height(); ++y) {
-            for (int x = 0; x < width(); ++x) {
-                QVector3D rayDir = QVector3D(x - width() / 2.0f, y - height() / 2.0f, 800).normalized();
+        for (int y = 0; y < h; ++y) {
+            for (int x = 0; x < w; ++x) {
+                QVector3D rayDir = QVector3D(x - w / 2.0f, y - h / 2.0f, 800).normalized();
                 pixels[x][y] = traceRay(cameraPos, rayDir, spheres, lightPos, lightColor);
             }
         }
 
-        for (int y = 0; y < height(); ++y) {
-            for (int x = 0; x < width(); ++x) {
-                QColor color = blur(pixels, x, y);
+        for (int y = 0; y < h; ++y) {
+            for (int x = 0; x < w; ++x) {
+                QColor color = blur(pixels, x, y, w, h);
                 image.setPixelColor(x, y, color);
             }
         }
 
-        painter.drawImage(0, 0, image);
+        return image;
+    }
+
+protected:
+    void paintEvent(QPaintEvent* event) override {
+        (void)event;
+        QPainter painter(this);
+        painter.drawImage(0, 0, renderFrame(width(), height()));
         qDebug() << "drawn";
     }
 
@@ -96,7 +109,7 @@ private:
     int maxBlurIntensity;
     int maxBlackBlurIntensity;
 
-    QColor blur(const std::vector<std::vector<distancedColor>>& pixels, int x, int y) {
+    QColor blur(const std::vector<std::vector<distancedColor>>& pixels, int x, int y, int w, int h) {
         float blurFactor = std::abs(pixels[x][y].distance - focusDistance) / depthOfField;
         blurFactor = std::clamp(blurFactor, 0.0f, 1.0f);
         int blurIntensity;
@@ -113,8 +126,8 @@ private:
         int green = 0;
         int blue  = 0;
 
-        for (int i = std::max(x-r, 0); i < std::min(x+r+1, width()); ++i) {
-            for (int j = std::max(y-r, 0); j < std::min(y+r+1, height()); ++j) {
+        for (int i = std::max(x-r, 0); i < std::min(x+r+1, w); ++i) {
+            for (int j = std::max(y-r, 0); j < std::min(y+r+1, h); ++j) {
                 red   += pixels[i][j].color.red();
                 green += pixels[i][j].color.green();
                 blue  += pixels[i][j].color.blue();
@@ -171,8 +184,154 @@ private:
     }
 };
 
+// * сравнение кадра с эталоном: пиксель "плохой", если хоть один канал отличается больше чем на tolerance
+int countMismatchedPixels(const QImage& frame, const QImage& golden, int tolerance, int* maxDiff) {
+    *maxDiff = 0;
+    if (frame.size() != golden.size()) {
+        return frame.width() * frame.height();
+    }
+
+    int mismatched = 0;
+    for (int y = 0; y < frame.height(); ++y) {
+        for (int x = 0; x < frame.width(); ++x) {
+            QRgb a = frame.pixel(x, y);
+            QRgb b = golden.pixel(x, y);
+            int diff = std::max({std::abs(qRed(a) - qRed(b)), std::abs(qGreen(a) - qGreen(b)), std::abs(qBlue(a) - qBlue(b))});
+            *maxDiff = std::max(*maxDiff, diff);
+            if (diff > tolerance) {
+                mismatched++;
+            }
+        }
+    }
+    return mismatched;
+}
+
+// * headless режим (без окна):
+// *   --render out.png        отрендерить кадр и сохранить
+// *   --compare golden.png    сравнить кадр с эталоном (--tolerance N, по умолчанию 2)
+// *   --baseline time.txt     сравнить время кадра с сохраненным (--threshold 1.25); нет файла или в нем
+// *                           не число - ошибка
+// *   --update-baseline       вместе с --baseline: записать текущее время как новое базовое
+// *   --focus D               фокусное расстояние сцены (по умолчанию 10)
+// *   --runs N                сколько раз рендерить для замера времени (берется медиана)
+// * код возврата != 0, если кадр не совпал с эталоном или стал медленнее порога.
+// * Эталоны и базовое время лежат в tests/, прогон всех проверок - tests/run_tests.sh (make check)
+int runHeadless(const QStringList& args) {
+    QString renderPath, goldenPath, baselinePath;
+    int tolerance = 2;
+    int runs = 3;
+    double threshold = 1.25;
+    float focus = 10.0f;
+    bool updateBaseline = false;
+
+    for (int i = 1; i < args.size(); ++i) {
+        if (args[i] == "--update-baseline") {
+            updateBaseline = true;
+            continue;
+        }
+        if (i + 1 == args.size()) {
+            break;
+        }
+        if (args[i] == "--render") renderPath = args[++i];
+        else if (args[i] == "--compare") goldenPath = args[++i];
+        else if (args[i] == "--baseline") baselinePath = args[++i];
+        else if (args[i] == "--tolerance") tolerance = args[++i].toInt();
+        else if (args[i] == "--threshold") threshold = args[++i].toDouble();
+        else if (args[i] == "--focus") focus = args[++i].toFloat();
+        else if (args[i] == "--runs") runs = std::max(1, args[++i].toInt());
+    }
+
+    if (updateBaseline && baselinePath.isEmpty()) {
+        qWarning() << "--update-baseline needs --baseline";
+        return 1;
+    }
+
+    DepthOfFieldWidget widget;
+    widget.setFocusDistance(focus);
+
+    QImage frame;
+    std::vector<qint64> times;
+    for (int i = 0; i < runs; ++i) {
+        QElapsedTimer timer;
+        timer.start();
+        frame = widget.renderFrame(widget.width(), widget.height());
+        times.push_back(timer.nsecsElapsed());
+    }
+    std::sort(times.begin(), times.end());
+    double frameMs = times[times.size() / 2] / 1e6;
+    qInfo() << "frame time, ms:" << frameMs;
+
+    int status = 0;
+
+    if (!renderPath.isEmpty() && !frame.save(renderPath)) {
+        qWarning() << "can't save" << renderPath;
+        status = 1;
+    }
+
+    if (!goldenPath.isEmpty()) {
+        QImage golden(goldenPath);
+        if (golden.isNull()) {
+            qWarning() << "can't load golden image" << goldenPath;
+            return 1;
+        }
+        int maxDiff;
+        int mismatched = countMismatchedPixels(frame, golden.convertToFormat(QImage::Format_RGB32), tolerance, &maxDiff);
+        qInfo() << "mismatched pixels:" << mismatched << "max channel diff:" << maxDiff;
+        if (mismatched > 0) {
+            status = 1;
+        }
+    }
+
+    if (!baselinePath.isEmpty() && updateBaseline) {
+        QFile file(baselinePath);
+        if (!file.open(QFile::WriteOnly | QFile::Truncate | QFile::Text)) {
+            qWarning() << "can't write baseline" << baselinePath;
+            return 1;
+        }
+        file.write(QByteArray::number(frameMs) + "\n");
+        qInfo() << "baseline saved to" << baselinePath;
+    } else if (!baselinePath.isEmpty()) {
+        // * без базового времени проверка производительности ничего не проверяет -> это ошибка
+        QFile file(baselinePath);
+        if (!file.open(QFile::ReadOnly | QFile::Text)) {
+            qWarning() << "can't read baseline" << baselinePath << "(create it with --update-baseline)";
+            return 1;
+        }
+        bool ok = false;
+        double baselineMs = file.readAll().trimmed().toDouble(&ok);
+        if (!ok || !(baselineMs > 0)) {
+            qWarning() << "invalid baseline in" << baselinePath;
+            return 1;
+        }
+        qInfo() << "baseline, ms:" << baselineMs << "limit, ms:" << baselineMs * threshold;
+        if (frameMs > baselineMs * threshold) {
+            status = 1;
+        }
+    }
+
+    return status;
+}
+
 int main(int argc, char* argv[]) {
+    bool headless = false;
+    for (int i = 1; i < argc; ++i) {
+        QByteArray arg(argv[i]);
+        if (arg == "--render" || arg == "--compare" || arg == "--baseline") {
+            headless = true;
+        }
+    }
+
+    // * без дисплея (ctest, ssh) нужна offscreen платформа
+    if (headless && qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM")) {
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+
     QApplication app(argc, argv);
+
+    if (headless) {
+        return runHeadless(app.arguments());
+    }
+
     DepthOfFieldWidget widget;
     widget.show();
     return app.exec();
@@ -7,4 +7,11 @@ QT += openglwidgets
 
 LIBS += -L/opt/homebrew/lib -lglfw -framework OpenGL
 
-SOURCES += main.cpp
\ No newline at end of file
+SOURCES += main.cpp
+
+# * make check: эталонные кадры и время кадра, без дисплея (tests/run_tests.sh); базовое время - в каталоге сборки
+macx: TEST_BINARY = $$OUT_PWD/$${TARGET}.app/Contents/MacOS/$$TARGET
+else: TEST_BINARY = $$OUT_PWD/$$TARGET
+check.commands = bash $$PWD/tests/run_tests.sh $$TEST_BINARY $$OUT_PWD/frame_baseline.txt
+check.depends = first
+QMAKE_EXTRA_TARGETS += check
\ No newline at end of file
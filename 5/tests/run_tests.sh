@@ -0,0 +1,38 @@
+#!/bin/bash
+# * прогон регрессионных проверок трассировщика без дисплея:
+# *   кадры для эталонных фокусных расстояний против tests/golden/focus_<D>.png - всегда
+# *   медианное время кадра против базового времени этой машины (файл в каталоге сборки, не в репозитории):
+# *   если файла нет, первый прогон записывает его и проверку времени пропускает
+# * usage: run_tests.sh <путь к qt_example> [файл базового времени]
+
+binary=${1:?usage: run_tests.sh <qt_example binary> [baseline file]}
+baseline=${2:-$(dirname "$binary")/frame_baseline.txt}
+tests=$(cd "$(dirname "$0")" && pwd)
+
+export QT_QPA_PLATFORM=offscreen
+
+status=0
+
+for focus in 6 10 14; do
+    if ! "$binary" --focus $focus --runs 1 --compare "$tests/golden/focus_$focus.png"; then
+        echo "FAIL: image, focus $focus"
+        status=1
+    fi
+done
+
+if [ ! -f "$baseline" ]; then
+    if "$binary" --focus 10 --runs 5 --baseline "$baseline" --update-baseline; then
+        echo "SKIP: frame time - no baseline for this machine yet, saved one to $baseline"
+    else
+        echo "FAIL: frame time - can't save a baseline to $baseline"
+        status=1
+    fi
+elif ! "$binary" --focus 10 --runs 5 --baseline "$baseline"; then
+    echo "FAIL: frame time (against $baseline; delete it to measure again)"
+    status=1
+fi
+
+if [ $status -eq 0 ]; then
+    echo "all checks passed"
+fi
+exit $status